@@ -0,0 +1,56 @@
+#define TILE 16
+
+// перестановки строк панели для столбцов правее неё, каждый work-item - один столбец
+kernel void swap_rows(global float* a, int n, int k, int kb, global const int* piv, int col0) {
+    const int j = col0 + get_global_id(0);
+    if (j >= n)
+        return;
+
+    for (int i = 0; i < kb; i++) {
+        const int r = piv[i];
+        if (r != k + i) {
+            const float c = a[(k + i) * n + j];
+            a[(k + i) * n + j] = a[r * n + j];
+            a[r * n + j] = c;
+        }
+    }
+}
+
+// A12 = L11^-1 * A12, L11 - нижняя треугольная kb x kb с единичной диагональю
+kernel void trsm_panel(global float* a, int n, int k, int kb, int col0) {
+    const int j = col0 + get_global_id(0);
+    if (j >= n)
+        return;
+
+    for (int i = 1; i < kb; i++) {
+        float s = a[(k + i) * n + j];
+        for (int p = 0; p < i; p++)
+            s -= a[(k + i) * n + k + p] * a[(k + p) * n + j];
+        a[(k + i) * n + j] = s;
+    }
+}
+
+// A22 -= A21 * A12, плитки TILE x TILE в локальной памяти
+kernel void gemm_update(global float* a, int n, int k, int kb) {
+    local float As[TILE][TILE];
+    local float Bs[TILE][TILE];
+
+    const int lr = get_local_id(1);
+    const int lc = get_local_id(0);
+    const int row = k + kb + get_global_id(1);
+    const int col = k + kb + get_global_id(0);
+
+    float acc = 0.0f;
+    for (int t = 0; t < kb; t += TILE) {
+        As[lr][lc] = (row < n && t + lc < kb) ? a[row * n + k + t + lc] : 0.0f;
+        Bs[lr][lc] = (t + lr < kb && col < n) ? a[(k + t + lr) * n + col] : 0.0f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int p = 0; p < TILE; p++)
+            acc += As[lr][p] * Bs[p][lc];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (row < n && col < n)
+        a[row * n + col] -= acc;
+}
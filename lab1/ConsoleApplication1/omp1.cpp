@@ -3,6 +3,31 @@
 #include <math.h>
 #include <omp.h>
 #include <chrono>
+#include <string.h>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#ifdef _WIN32
+#include <stdlib.h>
+#else
+#include <unistd.h>
+#endif
+
+#define EPS 0.001
+#define BLOCK_SIZE 64
+#define TUNE_REPEATS 3
+#define BENCH_REPEATS 5
+#define MIXED_TOL 1e-4
+#define OCL_PANEL 64
+#define OCL_TILE 16
+
+#ifdef USE_OPENCL
+#include "ocl_utils.h"
+#endif
+#include "stats.h"
 
 void SwapRows(float* a, int rowFrom, int rowTo, int n) {
 	float c = 0;
@@ -13,6 +38,19 @@ void SwapRows(float* a, int rowFrom, int rowTo, int n) {
 	}
 }
 
+float next_random(unsigned int& seed) {
+	seed = seed * 1664525u + 1013904223u;
+	return (float)(seed >> 8) / (1 << 23) - 1.0f;
+}
+
+// время с прошлой отметки, отметка переносится на текущий момент
+double lap(double& t) {
+	const double now = omp_get_wtime();
+	const double d = now - t;
+	t = now;
+	return d;
+}
+
 long double determinant_linear(float* a, int n) {
 	long double det = 1;
 
@@ -47,6 +85,7 @@ long double determinant_parallel(float* a, int n, int num_threads)
 	long double det = 1;
 
 	for (int i = 0; i < n; ++i) {
+		double t = stats ? omp_get_wtime() : 0;
 		int k = i;
 		for (int j = i + 1; j < n; ++j)
 			if (abs(a[j * n + i]) > abs(a[k * n + i]))
@@ -55,29 +94,809 @@ long double determinant_parallel(float* a, int n, int num_threads)
 			det = 0;
 			break;
 		}
+		if (stats)
+			stats->pivot += lap(t);
 		SwapRows(a, i, k, n);
 		if (i != k)
 			det = -det;
 		det *= a[i * n + i];
+		if (stats)
+			stats->swap += lap(t);
 
 #pragma omp parallel num_threads(num_threads)
 		{
-#pragma omp for schedule(static)
+			const int tid = omp_get_thread_num();
+			double tt = stats ? omp_get_wtime() : 0;
+#pragma omp for schedule(static) nowait
 			for (int j = i + 1; j < n; ++j)
 				a[i * n + j] /= a[i * n + i];
+			if (stats)
+				stats->normalize[tid] += lap(tt);
+#pragma omp barrier
+			if (stats)
+				stats->barrier[tid] += lap(tt);
 
-#pragma omp for schedule(static)
+#pragma omp for schedule(static) nowait
 			for (int j = 0; j < n; ++j)
 				if (j != i && abs(a[j * n + i]) > 0.001)
 					for (int k = i + 1; k < n; ++k)
 						a[j * n + k] -= a[i * n + k] * a[j * n + i];
+			if (stats)
+				stats->update[tid] += lap(tt);
+#pragma omp barrier
+			if (stats)
+				stats->barrier[tid] += lap(tt);
+		}
+	}
+
+	return det;
+}
+
+// C[m x n] -= A[m x k] * B[k x n], все матрицы хранятся по строкам
+template <typename T>
+void gemm_sub(const T* A, int lda, const T* B, int ldb, T* C, int ldc,
+	int m, int n, int k, int block, int num_threads) {
+	const int row_blocks = (m + block - 1) / block;
+
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if((long long)m * n * k > 1 << 18)
+	for (int bi = 0; bi < row_blocks; ++bi) {
+		const int i0 = bi * block;
+		const int i1 = i0 + block < m ? i0 + block : m;
+		for (int p0 = 0; p0 < k; p0 += block) {
+			const int p1 = p0 + block < k ? p0 + block : k;
+			for (int j0 = 0; j0 < n; j0 += 4 * block) {
+				const int j1 = j0 + 4 * block < n ? j0 + 4 * block : n;
+				int i = i0;
+				// 4 строки C за раз: каждая строка B из кэша используется четырежды
+				for (; i + 3 < i1; i += 4) {
+					T* __restrict c0 = C + i * ldc;
+					T* __restrict c1 = c0 + ldc;
+					T* __restrict c2 = c1 + ldc;
+					T* __restrict c3 = c2 + ldc;
+					for (int p = p0; p < p1; ++p) {
+						const T a0 = A[i * lda + p];
+						const T a1 = A[(i + 1) * lda + p];
+						const T a2 = A[(i + 2) * lda + p];
+						const T a3 = A[(i + 3) * lda + p];
+						const T* __restrict b = B + p * ldb;
+						for (int j = j0; j < j1; ++j) {
+							c0[j] -= a0 * b[j];
+							c1[j] -= a1 * b[j];
+							c2[j] -= a2 * b[j];
+							c3[j] -= a3 * b[j];
+						}
+					}
+				}
+				for (; i < i1; ++i) {
+					T* __restrict c = C + i * ldc;
+					for (int p = p0; p < p1; ++p) {
+						const T ai = A[i * lda + p];
+						const T* __restrict b = B + p * ldb;
+						for (int j = j0; j < j1; ++j)
+							c[j] -= ai * b[j];
+					}
+				}
+			}
+		}
+	}
+}
+
+// B[m x n] = L^-1 * B, L - нижняя треугольная m x m с единичной диагональю
+template <typename T>
+void trsm_lower_unit(const T* L, int ldl, T* B, int ldb, int m, int n, int block, int num_threads) {
+	if (m <= block) {
+		for (int i = 1; i < m; ++i)
+			for (int p = 0; p < i; ++p) {
+				const T l = L[i * ldl + p];
+				for (int j = 0; j < n; ++j)
+					B[i * ldb + j] -= l * B[p * ldb + j];
+			}
+		return;
+	}
+	const int m1 = m / 2;
+	trsm_lower_unit(L, ldl, B, ldb, m1, n, block, num_threads);
+	gemm_sub(L + m1 * ldl, ldl, B, ldb, B + m1 * ldb, ldb, m - m1, n, m1, block, num_threads);
+	trsm_lower_unit(L + m1 * ldl + m1, ldl, B + m1 * ldb, ldb, m - m1, n, block, num_threads);
+}
+
+template <typename T>
+void SwapRowsRange(T* a, int lda, int rowFrom, int rowTo, int cols) {
+	T c = 0;
+	for (int i = 0; i < cols; i++) {
+		c = a[rowFrom * lda + i];
+		a[rowFrom * lda + i] = a[rowTo * lda + i];
+		a[rowTo * lda + i] = c;
+	}
+}
+
+// LU-разложение панели m x nc без блоков, piv[j] - строка, переставленная с j-й
+template <typename T>
+bool lu_panel(T* a, int m, int nc, int lda, int* piv) {
+	for (int j = 0; j < nc; ++j) {
+		int k = j;
+		for (int i = j + 1; i < m; ++i)
+			if (fabs(a[i * lda + j]) > fabs(a[k * lda + j]))
+				k = i;
+		if (fabs(a[k * lda + j]) < EPS)
+			return false;
+		piv[j] = k;
+		if (k != j)
+			SwapRowsRange(a, lda, j, k, nc);
+		const T inv = 1 / a[j * lda + j];
+		for (int i = j + 1; i < m; ++i) {
+			const T l = a[i * lda + j] *= inv;
+			for (int p = j + 1; p < nc; ++p)
+				a[i * lda + p] -= l * a[j * lda + p];
+		}
+	}
+	return true;
+}
+
+/**
+ *	Рекурсивное разбиение на блоки 2x2: A11 раскладывается рекурсивно,
+ *	A12 = L11^-1 * A12, затем дополнение Шура A22 -= A21 * A12 (GEMM)
+ *	раскладывается тем же способом. det(A) = det(A11) * det(A22 - A21 * A11^-1 * A12)
+ **/
+template <typename T>
+bool lu_recursive(T* a, int m, int nc, int lda, int* piv, int block, int num_threads) {
+	if (nc <= block) {
+		double t = stats ? omp_get_wtime() : 0;
+		const bool ok = lu_panel(a, m, nc, lda, piv);
+		if (stats)
+			stats->panel += lap(t);
+		return ok;
+	}
+
+	const int n1 = nc / 2;
+	const int n2 = nc - n1;
+	if (!lu_recursive(a, m, n1, lda, piv, block, num_threads))
+		return false;
+	for (int i = 0; i < n1; ++i)
+		if (piv[i] != i)
+			SwapRowsRange(a + n1, lda, i, piv[i], n2);
+
+	double t = stats ? omp_get_wtime() : 0;
+	trsm_lower_unit(a, lda, a + n1, lda, n1, n2, block, num_threads);
+	if (stats)
+		stats->trsm += lap(t);
+	gemm_sub(a + n1 * lda, lda, a + n1, lda, a + n1 * lda + n1, lda, m - n1, n2, n1, block, num_threads);
+	if (stats)
+		stats->gemm += lap(t);
+
+	if (!lu_recursive(a + n1 * lda + n1, m - n1, n2, lda, piv + n1, block, num_threads))
+		return false;
+	for (int i = n1; i < nc; ++i) {
+		piv[i] += n1;
+		if (piv[i] != i)
+			SwapRowsRange(a, lda, i, piv[i], n1);
+	}
+	return true;
+}
+
+template <typename T>
+long double lu_determinant(const T* lu, int n, const int* piv) {
+	long double det = 1;
+	for (int i = 0; i < n; ++i) {
+		if (piv[i] != i)
+			det = -det;
+		det *= lu[i * n + i];
+	}
+	return det;
+}
+
+long double determinant_block(float* a, int n, int num_threads, int block) {
+	int* piv = (int*)malloc(n * sizeof(int));
+	long double det = 0;
+
+	if (lu_recursive(a, n, n, n, piv, block, num_threads))
+		det = lu_determinant(a, n, piv);
+	free(piv);
+	return det;
+}
+
+/**
+ *	Проверка LU-разложения, посчитанного во float: для x из +-1 в double считается
+ *	b = A * x, решается L * U * y = P * b и возвращается ||y - x|| / ||x||.
+ *	Ошибка порядка cond(A) * eps(float), стоит O(n^2) против O(n^3) разложения
+ **/
+double lu_check(const float* a, const float* lu, const int* piv, int n) {
+	double* y = (double*)malloc(n * sizeof(double));
+	unsigned int seed = n;
+
+	for (int i = 0; i < n; ++i) {
+		double b = 0;
+		unsigned int s = seed;
+		for (int j = 0; j < n; ++j)
+			b += (double)a[i * n + j] * (next_random(s) < 0 ? -1 : 1);
+		y[i] = b;
+	}
+	for (int i = 0; i < n; ++i)
+		if (piv[i] != i) {
+			const double c = y[i];
+			y[i] = y[piv[i]];
+			y[piv[i]] = c;
+		}
+	for (int i = 1; i < n; ++i)
+		for (int p = 0; p < i; ++p)
+			y[i] -= (double)lu[i * n + p] * y[p];
+	for (int i = n - 1; i >= 0; --i) {
+		for (int p = i + 1; p < n; ++p)
+			y[i] -= (double)lu[i * n + p] * y[p];
+		y[i] /= lu[i * n + i];
+	}
+
+	double err = 0;
+	for (int j = 0; j < n; ++j) {
+		const double d = fabs(y[j] - (next_random(seed) < 0 ? -1 : 1));
+		if (d > err)
+			err = d;
+	}
+	free(y);
+	return err;
+}
+
+/**
+ *	Разложение во float; если проверка lu_check не проходит порог MIXED_TOL
+ *	(или матрица вырождена во float), разложение повторяется в double.
+ *	Исходная матрица a не меняется
+ **/
+long double determinant_mixed(float* a, int n, int num_threads, int block) {
+	float* lu = (float*)malloc(n * n * sizeof(float));
+	int* piv = (int*)malloc(n * sizeof(int));
+	long double det = 0;
+	memcpy(lu, a, n * n * sizeof(float));
+
+	double err = -1;
+	if (lu_recursive(lu, n, n, n, piv, block, num_threads))
+		err = lu_check(a, lu, piv, n);
+	if (stats)
+		stats->mixed_error = err;
+
+	if (err >= 0 && err <= MIXED_TOL)
+		det = lu_determinant(lu, n, piv);
+	else {
+		double* lud = (double*)malloc(n * n * sizeof(double));
+		for (int i = 0; i < n * n; ++i)
+			lud[i] = a[i];
+		if (lu_recursive(lud, n, n, n, piv, block, num_threads))
+			det = lu_determinant(lud, n, piv);
+		free(lud);
+		if (stats)
+			stats->mixed_fallback = true;
+	}
+	free(lu);
+	free(piv);
+	return det;
+}
+
+#ifdef USE_OPENCL
+size_t round_up(size_t x, size_t m) {
+	return (x + m - 1) / m * m;
+}
+
+/**
+ *	Блочное LU-разложение на OpenCL-девайсе: панель шириной OCL_PANEL
+ *	раскладывается на хосте (lu_panel), перестановки, A12 и дополнение Шура
+ *	обновляются кернелами из determinant.cl
+ **/
+long double determinant_opencl(float* a, int n, int device_number) {
+	int total_devices = getDevices();
+	if (total_devices == 0)
+		error("No devices found. Check OpenCL installation!\n");
+	if (device_number < 0 || device_number >= total_devices)
+		device_number = 0;
+	cl_device_id device = all_devices[device_number];
+
+	cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, NULL);
+	cl_command_queue queue = clCreateCommandQueue(context, device, 0, NULL);
+	cl_program program = getProgram("determinant.cl", context);
+	buildProgram(program, device);
+	cl_kernel swapKernel = createKernel(program, "swap_rows");
+	cl_kernel trsmKernel = createKernel(program, "trsm_panel");
+	cl_kernel gemmKernel = createKernel(program, "gemm_update");
+
+	const cl_mem bufA = createBuffer(context, (size_t)n * n * sizeof(float), CL_MEM_READ_WRITE);
+	const cl_mem bufPiv = createBuffer(context, OCL_PANEL * sizeof(int), CL_MEM_READ_ONLY);
+	enqueueWriteBuffer(queue, bufA, (size_t)n * n * sizeof(float), a);
+
+	float* panel = (float*)malloc((size_t)n * OCL_PANEL * sizeof(float));
+	int piv[OCL_PANEL];
+	long double det = 1;
+
+	for (int k = 0; k < n; k += OCL_PANEL) {
+		const int kb = n - k < OCL_PANEL ? n - k : OCL_PANEL;
+		const int m = n - k;
+		const size_t origin[3] = { k * sizeof(float), (size_t)k, 0 };
+		const size_t host_origin[3] = { 0, 0, 0 };
+		const size_t region[3] = { kb * sizeof(float), (size_t)m, 1 };
+
+		clEnqueueReadBufferRect(queue, bufA, CL_TRUE, origin, host_origin, region,
+			n * sizeof(float), 0, kb * sizeof(float), 0, panel, 0, NULL, NULL);
+		if (!lu_panel(panel, m, kb, kb, piv)) {
+			det = 0;
+			break;
+		}
+		for (int i = 0; i < kb; ++i) {
+			if (piv[i] != i)
+				det = -det;
+			det *= panel[i * kb + i];
+			piv[i] += k;
+		}
+		if (k + kb == n)
+			break;
+
+		clEnqueueWriteBufferRect(queue, bufA, CL_FALSE, origin, host_origin, region,
+			n * sizeof(float), 0, kb * sizeof(float), 0, panel, 0, NULL, NULL);
+		clEnqueueWriteBuffer(queue, bufPiv, CL_FALSE, 0, kb * sizeof(int), piv, 0, NULL, NULL);
+
+		const int col0 = k + kb;
+		const size_t columns = round_up(n - col0, OCL_TILE);
+		clSetKernelArg(swapKernel, 0, sizeof(bufA), &bufA);
+		clSetKernelArg(swapKernel, 1, sizeof(int), &n);
+		clSetKernelArg(swapKernel, 2, sizeof(int), &k);
+		clSetKernelArg(swapKernel, 3, sizeof(int), &kb);
+		clSetKernelArg(swapKernel, 4, sizeof(bufPiv), &bufPiv);
+		clSetKernelArg(swapKernel, 5, sizeof(int), &col0);
+		clEnqueueNDRangeKernel(queue, swapKernel, 1, NULL, &columns, NULL, 0, NULL, NULL);
+
+		clSetKernelArg(trsmKernel, 0, sizeof(bufA), &bufA);
+		clSetKernelArg(trsmKernel, 1, sizeof(int), &n);
+		clSetKernelArg(trsmKernel, 2, sizeof(int), &k);
+		clSetKernelArg(trsmKernel, 3, sizeof(int), &kb);
+		clSetKernelArg(trsmKernel, 4, sizeof(int), &col0);
+		clEnqueueNDRangeKernel(queue, trsmKernel, 1, NULL, &columns, NULL, 0, NULL, NULL);
+
+		const size_t globalTreads[2] = { columns, columns };
+		const size_t localTreads[2] = { OCL_TILE, OCL_TILE };
+		clSetKernelArg(gemmKernel, 0, sizeof(bufA), &bufA);
+		clSetKernelArg(gemmKernel, 1, sizeof(int), &n);
+		clSetKernelArg(gemmKernel, 2, sizeof(int), &k);
+		clSetKernelArg(gemmKernel, 3, sizeof(int), &kb);
+		clEnqueueNDRangeKernel(queue, gemmKernel, 2, NULL, globalTreads, localTreads, 0, NULL, NULL);
+	}
+	clFinish(queue);
+
+	free(panel);
+	clReleaseMemObject(bufA);
+	clReleaseMemObject(bufPiv);
+	clReleaseKernel(swapKernel);
+	clReleaseKernel(trsmKernel);
+	clReleaseKernel(gemmKernel);
+	clReleaseProgram(program);
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+	return det;
+}
+#endif
+
+/**
+ *	Чтение строк матрицы в отдельном потоке: ready - количество уже прочитанных строк.
+ *	При ошибке чтения оставшиеся элементы заполняются нулями
+ **/
+void parse_rows(std::ifstream* in, float* a, int n, std::atomic<int>* ready) {
+	bool ok = true;
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			if (ok && !(*in >> a[i * n + j]))
+				ok = false;
+			if (!ok)
+				a[i * n + j] = 0;
+		}
+		ready->store(i + 1, std::memory_order_release);
+	}
+}
+
+/**
+ *	Чтение и разложение конвейером. Строка i текстового файла - это столбец i
+ *	матрицы M = A^T (det(A^T) = det(A)), поэтому LU-разложение M "слева направо"
+ *	по блокам столбцов может начаться, как только прочитаны первые block строк:
+ *	блоку столбцов J нужны только уже разложенные столбцы левее него.
+ *	В массиве a строка c хранит столбец c матрицы M
+ **/
+long double determinant_stream(std::ifstream& in, float* a, int n, int num_threads, int block) {
+	std::atomic<int> ready(0);
+	std::thread parser(parse_rows, &in, a, n, &ready);
+	int* piv = (int*)malloc(n * sizeof(int));
+	bool ok = true;
+
+	for (int j0 = 0; j0 < n && ok; j0 += block) {
+		const int j1 = j0 + block < n ? j0 + block : n;
+		const int jb = j1 - j0;
+		while (ready.load(std::memory_order_acquire) < j1)
+			std::this_thread::yield();
+
+		// перестановки прошлых блоков для новых столбцов
+#pragma omp parallel for num_threads(num_threads)
+		for (int c = j0; c < j1; ++c)
+			for (int i = 0; i < j0; ++i)
+				if (piv[i] != i) {
+					const float t = a[c * n + i];
+					a[c * n + i] = a[c * n + piv[i]];
+					a[c * n + piv[i]] = t;
+				}
+
+		// M[0:j0, J] = L^-1 * M[0:j0, J] по блокам, между блоками - GEMM
+		for (int b0 = 0; b0 < j0; b0 += block) {
+			const int b1 = b0 + block < j0 ? b0 + block : j0;
+#pragma omp parallel for num_threads(num_threads)
+			for (int c = j0; c < j1; ++c)
+				for (int p = b0; p < b1; ++p) {
+					const float x = a[c * n + p];
+					for (int i = p + 1; i < b1; ++i)
+						a[c * n + i] -= a[p * n + i] * x;
+				}
+			if (b1 < j0)
+				gemm_sub(a + j0 * n + b0, n, a + b0 * n + b1, n, a + j0 * n + b1, n,
+					jb, j0 - b1, b1 - b0, block, num_threads);
+		}
+		// M[j0:n, J] -= M[j0:n, 0:j0] * M[0:j0, J]
+		if (j0 > 0)
+			gemm_sub(a + j0 * n, n, a + j0, n, a + j0 * n + j0, n, jb, n - j0, j0, block, num_threads);
+
+		// разложение панели M[j0:n, J], её столбцы - строки a
+		for (int j = j0; j < j1 && ok; ++j) {
+			int k = j;
+			for (int r = j + 1; r < n; ++r)
+				if (fabs(a[j * n + r]) > fabs(a[j * n + k]))
+					k = r;
+			if (fabs(a[j * n + k]) < EPS) {
+				ok = false;
+				break;
+			}
+			piv[j] = k;
+			if (k != j)
+				for (int c = j0; c < j1; ++c) {
+					const float t = a[c * n + j];
+					a[c * n + j] = a[c * n + k];
+					a[c * n + k] = t;
+				}
+			const float inv = 1.0f / a[j * n + j];
+			for (int r = j + 1; r < n; ++r)
+				a[j * n + r] *= inv;
+#pragma omp parallel for num_threads(num_threads) if(n - j > 1024)
+			for (int c = j + 1; c < j1; ++c) {
+				const float u = a[c * n + j];
+				for (int r = j + 1; r < n; ++r)
+					a[c * n + r] -= a[j * n + r] * u;
+			}
 		}
+		if (!ok)
+			break;
+
+		// перестановки блока для уже разложенных столбцов, чтобы L оставалась согласованной
+#pragma omp parallel for num_threads(num_threads)
+		for (int c = 0; c < j0; ++c)
+			for (int i = j0; i < j1; ++i)
+				if (piv[i] != i) {
+					const float t = a[c * n + i];
+					a[c * n + i] = a[c * n + piv[i]];
+					a[c * n + piv[i]] = t;
+				}
 	}
+	parser.join();
 
+	long double det = ok ? lu_determinant(a, n, piv) : 0;
+	free(piv);
 	return det;
 }
 
+long double determinant(float* a, int n, const char* engine, int num_threads, int block) {
+	if (strcmp(engine, "block") == 0)
+		return determinant_block(a, n, num_threads == -1 ? 1 : num_threads, block);
+	if (strcmp(engine, "mixed") == 0)
+		return determinant_mixed(a, n, num_threads == -1 ? 1 : num_threads, block);
+	return num_threads == -1 ?
+		determinant_linear(a, n) : determinant_parallel(a, n, num_threads);
+}
+
+// движки determinant() и main; ocl есть только в сборке с USE_OPENCL
+bool known_engine(const char* engine) {
+	const char* names[] = { "gauss", "block", "mixed", "stream", "ocl" };
+	for (const char* name : names)
+		if (strcmp(engine, name) == 0)
+			return true;
+	return false;
+}
+
+void print_usage() {
+	printf_s("Использование: \n\tConsoleApplication1.exe <имя_входного_файла> <кол-во_потоков>|auto [gauss|block|mixed|stream|ocl [<номер_девайса>]] [--stats <файл_json>]\n\tConsoleApplication1.exe --autotune [<файл_профиля>]\n\tConsoleApplication1.exe --bench [<префикс_вывода> [<кол-во_повторов> [<n1,n2,...>]]]");
+}
+
+struct tune_entry {
+	int n;
+	char engine[16];
+	int num_threads;
+	int block;
+	double ms;
+};
+
+void fill_random(float* a, int n, unsigned int seed) {
+	for (int i = 0; i < n * n; ++i)
+		a[i] = next_random(seed);
+}
+
+/**
+ *	Воспроизводимые тестовые матрицы:
+ *	random - равномерные значения в [-1, 1);
+ *	diag - с диагональным преобладанием (перестановки строк не нужны);
+ *	ill - плохо обусловленная: строки масштабированы от 1 до 1e-2;
+ *	sparse - около 5% ненулевых элементов и ненулевая диагональ
+ **/
+bool fill_matrix(float* a, int n, const char* kind, unsigned int seed) {
+	fill_random(a, n, seed);
+	if (strcmp(kind, "random") == 0)
+		return true;
+	if (strcmp(kind, "diag") == 0) {
+		for (int i = 0; i < n; ++i)
+			a[i * n + i] = (float)n;
+		return true;
+	}
+	if (strcmp(kind, "ill") == 0) {
+		for (int i = 0; i < n; ++i) {
+			const float scale = powf(10.0f, -2.0f * i / n);
+			for (int j = 0; j < n; ++j)
+				a[i * n + j] *= scale;
+		}
+		return true;
+	}
+	if (strcmp(kind, "sparse") == 0) {
+		for (int i = 0; i < n * n; ++i)
+			if (fabsf(next_random(seed)) > 0.05f)
+				a[i] = 0;
+		for (int i = 0; i < n; ++i)
+			a[i * n + i] = 1.0f + fabsf(next_random(seed));
+		return true;
+	}
+	return false;
+}
+
+std::string default_profile_path() {
+	char host[256] = "localhost";
+#ifdef _WIN32
+	const char* name = getenv("COMPUTERNAME");
+	if (name)
+		strncpy_s(host, name, sizeof(host) - 1);
+#else
+	gethostname(host, sizeof(host) - 1);
+#endif
+	return std::string("autotune_") + host + ".txt";
+}
+
+// время (мс) каждого из repeats запусков, матрица копируется перед каждым, т.к. движки портят её
+void measure_engine(const float* src, float* work, int n, const char* engine, int num_threads, int block,
+	int repeats, std::vector<double>& times) {
+	times.clear();
+	for (int r = 0; r < repeats; ++r) {
+		memcpy(work, src, n * n * sizeof(float));
+		auto start = std::chrono::high_resolution_clock::now();
+		determinant(work, n, engine, num_threads, block);
+		auto end = std::chrono::high_resolution_clock::now();
+		times.push_back((end - start) / std::chrono::microseconds(1) / 1000.0);
+	}
+}
+
+// лучшее время из TUNE_REPEATS запусков
+double time_engine(const float* src, float* work, int n, const char* engine, int num_threads, int block) {
+	std::vector<double> times;
+	measure_engine(src, work, n, engine, num_threads, block, TUNE_REPEATS, times);
+	return *std::min_element(times.begin(), times.end());
+}
+
+/**
+ *	Перебирает движки, количество потоков и размер блока на матрицах разного размера
+ *	и сохраняет лучшую конфигурацию для каждого n в файл профиля
+ **/
+int autotune(const char* path) {
+	const int sizes[] = { 128, 256, 512, 1024 };
+	const int blocks[] = { 32, 64, 128, 256 };
+	const int max_threads = omp_get_max_threads();
+
+	std::vector<int> threads;
+	threads.push_back(-1);
+	for (int t = 1; t < max_threads; t *= 2)
+		threads.push_back(t);
+	threads.push_back(max_threads);
+
+	FILE* out = fopen(path, "w");
+	if (!out) {
+		printf_s("File not created\n");
+		return 1;
+	}
+	fprintf(out, "# n engine threads block ms\n");
+
+	for (int n : sizes) {
+		float* src = (float*)malloc(n * n * sizeof(float));
+		float* work = (float*)malloc(n * n * sizeof(float));
+		fill_random(src, n, n);
+
+		tune_entry best = { n, "gauss", -1, 0, -1 };
+		for (int t : threads) {
+			double ms = time_engine(src, work, n, "gauss", t, 0);
+			printf_s("n=%d gauss threads=%d: %.3f ms\n", n, t, ms);
+			if (best.ms < 0 || ms < best.ms) {
+				best = { n, "gauss", t, 0, ms };
+			}
+			if (t == -1)
+				continue;
+			for (int b : blocks) {
+				if (b > n)
+					break;
+				ms = time_engine(src, work, n, "block", t, b);
+				printf_s("n=%d block threads=%d block=%d: %.3f ms\n", n, t, b, ms);
+				if (ms < best.ms)
+					best = { n, "block", t, b, ms };
+			}
+		}
+		fprintf(out, "%d %s %d %d %.3f\n", best.n, best.engine, best.num_threads, best.block, best.ms);
+		free(src);
+		free(work);
+	}
+	fclose(out);
+	printf_s("\nProfile saved: %s\n", path);
+	return 0;
+}
+
+bool load_profile(const char* path, std::vector<tune_entry>& profile) {
+	std::ifstream in(path);
+	if (!in)
+		return false;
+	std::string line;
+	while (std::getline(in, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream ss(line);
+		std::string engine;
+		tune_entry e = {};
+		if (ss >> e.n >> engine >> e.num_threads >> e.block >> e.ms) {
+			strncpy(e.engine, engine.c_str(), sizeof(e.engine) - 1);
+			e.engine[sizeof(e.engine) - 1] = 0;
+			profile.push_back(e);
+		}
+	}
+	return !profile.empty();
+}
+
+// конфигурация из профиля с ближайшим (в логарифмическом масштабе) размером матрицы
+const tune_entry* pick_config(const std::vector<tune_entry>& profile, int n) {
+	const tune_entry* best = NULL;
+	double best_dist = 0;
+	for (const tune_entry& e : profile) {
+		const double dist = fabs(log((double)e.n / n));
+		if (!best || dist < best_dist) {
+			best = &e;
+			best_dist = dist;
+		}
+	}
+	return best;
+}
+
+struct bench_result {
+	std::string kind;
+	int n;
+	std::string engine;
+	int num_threads;
+	double median;
+	double mean;
+	double ci95;
+	double speedup;
+	double efficiency;
+};
+
+// критические значения t-распределения (0.975) для 1..10 степеней свободы
+const double T975[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228 };
+
+void summarize(std::vector<double> times, bench_result& r) {
+	std::sort(times.begin(), times.end());
+	const size_t m = times.size();
+	r.median = m % 2 ? times[m / 2] : (times[m / 2 - 1] + times[m / 2]) / 2;
+
+	double sum = 0, sq = 0;
+	for (double t : times)
+		sum += t;
+	r.mean = sum / m;
+	for (double t : times)
+		sq += (t - r.mean) * (t - r.mean);
+	r.ci95 = 0;
+	if (m > 1)
+		r.ci95 = (m - 1 <= 10 ? T975[m - 2] : 1.96) * sqrt(sq / (m - 1) / m);
+}
+
+/**
+ *	Прогоняет все движки по всем видам матриц, размерам и количеству потоков:
+ *	один прогрев, затем repeats замеров. Ускорение и эффективность считаются
+ *	относительно determinant_linear на той же матрице
+ **/
+int bench(const char* prefix, int repeats, const std::vector<int>& sizes) {
+	const char* kinds[] = { "random", "diag", "ill", "sparse" };
+	const int max_threads = omp_get_max_threads();
+	std::vector<int> threads;
+	for (int t = 1; t < max_threads; t *= 2)
+		threads.push_back(t);
+	threads.push_back(max_threads);
+
+	std::vector<bench_result> results;
+	std::vector<double> times;
+	for (const char* kind : kinds) {
+		for (int n : sizes) {
+			float* src = (float*)malloc(n * n * sizeof(float));
+			float* work = (float*)malloc(n * n * sizeof(float));
+			fill_matrix(src, n, kind, n);
+
+			bench_result r = { kind, n, "linear", 1, 0, 0, 0, 0, 0 };
+			measure_engine(src, work, n, "gauss", -1, 0, 1, times);
+			measure_engine(src, work, n, "gauss", -1, 0, repeats, times);
+			summarize(times, r);
+			const double base = r.median;
+			r.speedup = r.efficiency = 1;
+			results.push_back(r);
+			printf_s("%s n=%d linear: %.3f ms\n", kind, n, r.median);
+
+			const char* engines[] = { "gauss", "block", "mixed" };
+			for (const char* engine : engines) {
+				for (int t : threads) {
+					r = { kind, n, engine, t, 0, 0, 0, 0, 0 };
+					measure_engine(src, work, n, engine, t, BLOCK_SIZE, 1, times);
+					measure_engine(src, work, n, engine, t, BLOCK_SIZE, repeats, times);
+					summarize(times, r);
+					r.speedup = base / r.median;
+					r.efficiency = r.speedup / t;
+					results.push_back(r);
+					printf_s("%s n=%d %s threads=%d: %.3f ms (x%.2f)\n", kind, n, engine, t, r.median, r.speedup);
+				}
+			}
+			free(src);
+			free(work);
+		}
+	}
+
+	FILE* csv = fopen((std::string(prefix) + ".csv").c_str(), "w");
+	FILE* json = fopen((std::string(prefix) + ".json").c_str(), "w");
+	if (!csv || !json) {
+		printf_s("File not created\n");
+		return 1;
+	}
+	fprintf(csv, "kind,n,engine,threads,median_ms,mean_ms,ci95_ms,speedup,efficiency\n");
+	fprintf(json, "[\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const bench_result& r = results[i];
+		fprintf(csv, "%s,%d,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n", r.kind.c_str(), r.n, r.engine.c_str(),
+			r.num_threads, r.median, r.mean, r.ci95, r.speedup, r.efficiency);
+		fprintf(json, "  {\"kind\": \"%s\", \"n\": %d, \"engine\": \"%s\", \"threads\": %d, "
+			"\"median_ms\": %.3f, \"mean_ms\": %.3f, \"ci95_ms\": %.3f, \"speedup\": %.3f, \"efficiency\": %.3f}%s\n",
+			r.kind.c_str(), r.n, r.engine.c_str(), r.num_threads, r.median, r.mean, r.ci95,
+			r.speedup, r.efficiency, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(json, "]\n");
+	fclose(csv);
+	fclose(json);
+	printf_s("\nResults saved: %s.csv, %s.json\n", prefix, prefix);
+	return 0;
+}
+
 int main(int argc, char* argv[]) {
+	if (argc > 1 && strcmp(argv[1], "--autotune") == 0)
+		return autotune(argc > 2 ? argv[2] : default_profile_path().c_str());
+
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+		const int repeats = argc > 3 ? atoi(argv[3]) : BENCH_REPEATS;
+		std::vector<int> sizes;
+		if (argc > 4) {
+			std::istringstream ss(argv[4]);
+			std::string size;
+			while (std::getline(ss, size, ','))
+				sizes.push_back(atoi(size.c_str()));
+		}
+		else
+			sizes = { 256, 512, 1024 };
+		return bench(argc > 2 ? argv[2] : "mp1", repeats < 1 ? 1 : repeats, sizes);
+	}
+
+	const char* stats_path = NULL;
+	if (argc > 3 && strcmp(argv[argc - 2], "--stats") == 0) {
+		stats_path = argv[argc - 1];
+		argc -= 2;
+	}
+
 	if (argc > 2) {
 		int n;
 		std::ifstream in(argv[1]);
@@ -88,30 +907,93 @@ int main(int argc, char* argv[]) {
 
 		int num_threads = atoi(argv[2]);
 		if(num_threads == 0) num_threads = omp_get_max_threads();
+		const char* engine = argc > 3 ? argv[3] : "gauss";
+		int block = BLOCK_SIZE;
 		in >> n;
 
+		std::vector<tune_entry> profile;
+		if (strcmp(argv[2], "auto") == 0) {
+			const std::string path = default_profile_path();
+			const tune_entry* e = load_profile(path.c_str(), profile) ? pick_config(profile, n) : NULL;
+			if (e) {
+				engine = e->engine;
+				num_threads = e->num_threads;
+				if (e->block > 0)
+					block = e->block;
+			}
+			else {
+				printf_s("Profile %s not found, run --autotune first\n", path.c_str());
+				engine = "block";
+				num_threads = omp_get_max_threads();
+			}
+			printf_s("Engine: %s, %i thread(s), block %i\n", engine, num_threads, block);
+		}
+		// неизвестное имя (опечатка) не должно молча считаться методом Гаусса
+		if (!known_engine(engine)) {
+			printf_s("Unknown engine: %s\n", engine);
+			print_usage();
+			return 1;
+		}
+#ifndef USE_OPENCL
+		if (strcmp(engine, "ocl") == 0) {
+			printf_s("Built without OpenCL, engine ocl is not available\n");
+			return 1;
+		}
+#endif
+
+		det_stats run_stats;
+		const int team = num_threads == -1 ? 1 : num_threads;
+		if (stats_path) {
+			stats_init(&run_stats, engine, n, team);
+			stats = &run_stats;
+		}
+
+		// в режиме stream чтение идёт параллельно с разложением и входит в замер времени
+		const bool stream = strcmp(engine, "stream") == 0;
+		double t = omp_get_wtime();
 		float* mat = (float*)malloc(n * n * sizeof(float));
-		for (int i = 0; i < n; i++) {
-			for (int j = 0; j < n; j++) {
-				in >> mat[i * n + j];
+		if (!stream) {
+			for (int i = 0; i < n; i++) {
+				for (int j = 0; j < n; j++) {
+					in >> mat[i * n + j];
+				}
 			}
+			in.close();
+		}
+		if (stats) {
+			stats->parse = lap(t);
+			counters_start(team);
 		}
-		in.close();
 		long double det;
 		auto start = std::chrono::high_resolution_clock::now();
 
-		det = num_threads == -1 ?
-			determinant_linear(mat, n) : determinant_parallel(mat, n, num_threads);
+		if (stream)
+			det = determinant_stream(in, mat, n, team, block);
+		else
+#ifdef USE_OPENCL
+		if (strcmp(engine, "ocl") == 0)
+			det = determinant_opencl(mat, n, argc > 4 ? atoi(argv[4]) : 0);
+		else
+#endif
+		det = determinant(mat, n, engine, num_threads, block);
 
 		auto end = std::chrono::high_resolution_clock::now();
-		const auto delta = (end - start) / std::chrono::milliseconds(1);
+		const long long delta = (end - start) / std::chrono::milliseconds(1);
 
 		printf_s("Determinant: %g\n", det);
-		printf_s("\nTime (%i thread(s)): %f ms\n", num_threads, delta);
+		printf_s("\nTime (%i thread(s)): %lld ms\n", num_threads, delta);
+
+		if (stats) {
+			counters_stop();
+			stats->total = (end - start) / std::chrono::microseconds(1) * 1e-6;
+			if (!stats_write_json(stats_path))
+				printf_s("File not created\n");
+			stats = NULL;
+		}
 
 		free(mat);
 	}
 	else
-		printf_s(": \n\tConsoleApplication1.exe <__> <-_>");
+		print_usage();
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define COUNTERS 3
+#define CACHE_LINE 64
+
+det_stats* stats = NULL;
+
+void stats_init(det_stats* s, const char* engine, int n, int num_threads) {
+	s->engine = engine;
+	s->n = n;
+	s->num_threads = num_threads;
+	s->parse = s->pivot = s->swap = 0;
+	s->panel = s->trsm = s->gemm = 0;
+	s->total = 0;
+	s->mixed_error = 0;
+	s->mixed_fallback = false;
+	s->normalize.assign(num_threads, 0);
+	s->update.assign(num_threads, 0);
+	s->barrier.assign(num_threads, 0);
+	s->counters = false;
+	s->cycles = s->instructions = s->llc_misses = 0;
+}
+
+#ifdef __linux__
+// счётчики открываются в каждом потоке команды OpenMP: с inherit значения
+// потоков пула попадали бы в родителя только после их завершения
+static std::vector<int> fds;
+
+static int open_counter(unsigned long long config) {
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void counters_start(int num_threads) {
+#ifdef __linux__
+	const unsigned long long configs[COUNTERS] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+	fds.assign(num_threads * COUNTERS, -1);
+
+#pragma omp parallel num_threads(num_threads)
+	{
+		const int tid = omp_get_thread_num();
+		for (int c = 0; c < COUNTERS; ++c) {
+			const int fd = open_counter(configs[c]);
+			fds[tid * COUNTERS + c] = fd;
+			if (fd >= 0) {
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+	}
+#endif
+}
+
+void counters_stop() {
+#ifdef __linux__
+	long long totals[COUNTERS] = { 0, 0, 0 };
+	bool ok = !fds.empty();
+
+	for (size_t i = 0; i < fds.size(); ++i) {
+		long long value = 0;
+		if (fds[i] < 0) {
+			ok = false;
+			continue;
+		}
+		ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fds[i], &value, sizeof(value)) == sizeof(value))
+			totals[i % COUNTERS] += value;
+		else
+			ok = false;
+		close(fds[i]);
+	}
+	fds.clear();
+
+	if (stats) {
+		stats->counters = ok;
+		stats->cycles = totals[0];
+		stats->instructions = totals[1];
+		stats->llc_misses = totals[2];
+	}
+#endif
+}
+
+static double mean(const std::vector<double>& v) {
+	double s = 0;
+	for (double x : v)
+		s += x;
+	return v.empty() ? 0 : s / v.size();
+}
+
+static void write_array(FILE* out, const char* name, const std::vector<double>& v) {
+	fprintf(out, "    \"%s\": [", name);
+	for (size_t i = 0; i < v.size(); ++i)
+		fprintf(out, "%s%.6f", i ? ", " : "", v[i]);
+	fprintf(out, "]");
+}
+
+bool stats_write_json(const char* path) {
+	if (!stats)
+		return false;
+	FILE* out = fopen(path, "w");
+	if (!out)
+		return false;
+
+	// дисбаланс: отношение максимальной занятости потока к средней
+	std::vector<double> busy(stats->num_threads);
+	double max_busy = 0;
+	for (int t = 0; t < stats->num_threads; ++t) {
+		busy[t] = stats->normalize[t] + stats->update[t];
+		if (busy[t] > max_busy)
+			max_busy = busy[t];
+	}
+	const double avg_busy = mean(busy);
+	const double flops = 2.0 / 3.0 * stats->n * stats->n * (double)stats->n;
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"engine\": \"%s\",\n", stats->engine);
+	fprintf(out, "  \"n\": %d,\n", stats->n);
+	fprintf(out, "  \"threads\": %d,\n", stats->num_threads);
+	fprintf(out, "  \"phases\": {\n");
+	fprintf(out, "    \"parse\": %.6f,\n", stats->parse);
+	fprintf(out, "    \"pivot\": %.6f,\n", stats->pivot);
+	fprintf(out, "    \"swap\": %.6f,\n", stats->swap);
+	fprintf(out, "    \"normalize\": %.6f,\n", mean(stats->normalize));
+	fprintf(out, "    \"update\": %.6f,\n", mean(stats->update));
+	fprintf(out, "    \"barrier\": %.6f,\n", mean(stats->barrier));
+	fprintf(out, "    \"panel\": %.6f,\n", stats->panel);
+	fprintf(out, "    \"trsm\": %.6f,\n", stats->trsm);
+	fprintf(out, "    \"gemm\": %.6f,\n", stats->gemm);
+	fprintf(out, "    \"total\": %.6f\n", stats->total);
+	fprintf(out, "  },\n");
+	fprintf(out, "  \"threads_detail\": {\n");
+	write_array(out, "normalize", stats->normalize);
+	fprintf(out, ",\n");
+	write_array(out, "update", stats->update);
+	fprintf(out, ",\n");
+	write_array(out, "barrier", stats->barrier);
+	fprintf(out, ",\n    \"imbalance\": %.4f\n", avg_busy > 0 ? max_busy / avg_busy : 1.0);
+	fprintf(out, "  },\n");
+	if (strcmp(stats->engine, "mixed") == 0)
+		fprintf(out, "  \"mixed\": { \"error\": %g, \"fallback\": %s },\n",
+			stats->mixed_error, stats->mixed_fallback ? "true" : "false");
+	fprintf(out, "  \"gflops\": %.3f,\n", stats->total > 0 ? flops / stats->total * 1e-9 : 0);
+	if (stats->counters) {
+		fprintf(out, "  \"counters\": {\n");
+		fprintf(out, "    \"cycles\": %lld,\n", stats->cycles);
+		fprintf(out, "    \"instructions\": %lld,\n", stats->instructions);
+		fprintf(out, "    \"llc_misses\": %lld,\n", stats->llc_misses);
+		fprintf(out, "    \"ipc\": %.3f,\n", stats->cycles ? (double)stats->instructions / stats->cycles : 0);
+		fprintf(out, "    \"gbps\": %.3f\n", stats->total > 0 ? stats->llc_misses * CACHE_LINE / stats->total * 1e-9 : 0);
+		fprintf(out, "  }\n");
+	}
+	else
+		fprintf(out, "  \"counters\": null\n");
+	fprintf(out, "}\n");
+	fclose(out);
+	return true;
+}
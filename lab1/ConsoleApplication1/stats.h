@@ -0,0 +1,47 @@
+#pragma once
+#include <stdio.h>
+#include <vector>
+
+// printf_s есть только у MSVC, а счётчики perf_event собираются на Linux
+#ifndef _WIN32
+#define printf_s printf
+#endif
+
+/**
+ *	Время по фазам (в секундах) и аппаратные счётчики одного запуска движка.
+ *	Фазы normalize, update и barrier считаются отдельно для каждого потока
+ **/
+struct det_stats {
+	const char* engine;
+	int n;
+	int num_threads;
+
+	double parse;
+	double pivot;
+	double swap;
+	double panel;
+	double trsm;
+	double gemm;
+	double total;
+
+	// движок mixed: ошибка проверки float-разложения (-1 - вырождена во float) и был ли пересчёт в double
+	double mixed_error;
+	bool mixed_fallback;
+
+	std::vector<double> normalize;
+	std::vector<double> update;
+	std::vector<double> barrier;
+
+	bool counters;
+	long long cycles;
+	long long instructions;
+	long long llc_misses;
+};
+
+// NULL, если статистика не собирается
+extern det_stats* stats;
+
+void stats_init(det_stats* s, const char* engine, int n, int num_threads);
+void counters_start(int num_threads);
+void counters_stop();
+bool stats_write_json(const char* path);
@@ -0,0 +1,91 @@
+"""Builds the lab1 scaling table and charts (mp1.xlsx) from the CSV written by
+``ConsoleApplication1.exe --bench <prefix>``.
+
+Usage: python mp1_table.py <prefix>.csv [mp1.xlsx]
+
+One sheet per matrix kind: for every engine a block of rows (threads) by
+columns (n) with the median time in ms, followed by the speedup and parallel
+efficiency blocks, and a speedup-vs-threads line chart per engine.
+"""
+import csv
+import sys
+from collections import defaultdict
+
+
+def load(path):
+    rows = []
+    with open(path, newline="") as f:
+        for r in csv.DictReader(f):
+            r["n"] = int(r["n"])
+            r["threads"] = int(r["threads"])
+            for key in ("median_ms", "mean_ms", "ci95_ms", "speedup", "efficiency"):
+                r[key] = float(r[key])
+            rows.append(r)
+    return rows
+
+
+def pivot(rows, value):
+    """{kind: {engine: (sizes, threads, {(threads, n): value})}}"""
+    grouped = defaultdict(lambda: defaultdict(list))
+    for r in rows:
+        grouped[r["kind"]][r["engine"]].append(r)
+    tables = {}
+    for kind, engines in grouped.items():
+        tables[kind] = {}
+        for engine, items in engines.items():
+            sizes = sorted({r["n"] for r in items})
+            threads = sorted({r["threads"] for r in items})
+            cells = {(r["threads"], r["n"]): r[value] for r in items}
+            tables[kind][engine] = (sizes, threads, cells)
+    return tables
+
+
+def write_block(ws, top, title, sizes, threads, cells):
+    ws.cell(row=top, column=1, value=title)
+    ws.cell(row=top + 1, column=1, value="Потоки")
+    for j, n in enumerate(sizes):
+        ws.cell(row=top + 1, column=2 + j, value=n)
+    for i, t in enumerate(threads):
+        ws.cell(row=top + 2 + i, column=1, value=t)
+        for j, n in enumerate(sizes):
+            ws.cell(row=top + 2 + i, column=2 + j, value=cells.get((t, n)))
+    return top + 3 + len(threads)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    from openpyxl import Workbook
+    from openpyxl.chart import LineChart, Reference
+
+    rows = load(sys.argv[1])
+    out = sys.argv[2] if len(sys.argv) > 2 else "mp1.xlsx"
+    times, speedups, efficiency = pivot(rows, "median_ms"), pivot(rows, "speedup"), pivot(rows, "efficiency")
+
+    wb = Workbook()
+    wb.remove(wb.active)
+    for kind in times:
+        ws = wb.create_sheet(kind)
+        top = 1
+        for engine, (sizes, threads, cells) in times[kind].items():
+            top = write_block(ws, top, "%s: время, мс" % engine, sizes, threads, cells)
+            chart_top = top
+            top = write_block(ws, top, "%s: ускорение" % engine, sizes, threads, speedups[kind][engine][2])
+            top = write_block(ws, top, "%s: эффективность" % engine, sizes, threads, efficiency[kind][engine][2])
+            if len(threads) > 1:
+                chart = LineChart()
+                chart.title = "%s, %s: ускорение" % (kind, engine)
+                chart.x_axis.title = "Потоки"
+                chart.y_axis.title = "Ускорение"
+                data = Reference(ws, min_col=2, max_col=1 + len(sizes),
+                                 min_row=chart_top + 1, max_row=chart_top + 1 + len(threads))
+                chart.add_data(data, titles_from_data=True)
+                chart.set_categories(Reference(ws, min_col=1, min_row=chart_top + 2,
+                                               max_row=chart_top + 1 + len(threads)))
+                ws.add_chart(chart, "%s%d" % (chr(ord("C") + len(sizes)), chart_top))
+    wb.save(out)
+    print("Saved", out)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,59 @@
+// отсчёт i растра: байт или 16 бит старшим байтом вперёд, как в файле. Отсчёты больше maxval
+// (испорченный файл) считаются равными maxval, чтобы не писать за гистограмму и таблицу
+uint sample(global const uchar* data, uint i, uint wide, uint bins) {
+    return min(wide ? ((uint)data[2 * i] << 8) | data[2 * i + 1] : (uint)data[i], bins - 1);
+}
+
+/**
+ *  Гистограмма: у каждой рабочей группы своя гистограмма в локальной памяти (bins ячеек на таблицу),
+ *  в конце она прибавляется к общей атомарно, только ненулевые ячейки.
+ *  Рабочие элементы идут по отсчётам с шагом в размер всей сетки
+ **/
+kernel void histogram_local(global const uchar* data, uint n, uint wide, uint tables, uint bins,
+    global uint* count, local uint* sub) {
+    const uint lid = get_local_id(0);
+    const uint size = tables * bins;
+    for (uint c = lid; c < size; c += get_local_size(0))
+        sub[c] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint i = get_global_id(0); i < n; i += get_global_size(0))
+        atomic_inc(&sub[(tables == 3 ? i % 3 : 0) * bins + sample(data, i, wide, bins)]);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint c = lid; c < size; c += get_local_size(0))
+        if (sub[c])
+            atomic_add(&count[c], sub[c]);
+}
+
+// то же без локальной памяти, для 16-битных гистограмм, которые в неё не помещаются
+kernel void histogram_global(global const uchar* data, uint n, uint wide, uint tables, uint bins,
+    global uint* count) {
+    for (uint i = get_global_id(0); i < n; i += get_global_size(0))
+        atomic_inc(&count[(tables == 3 ? i % 3 : 0) * bins + sample(data, i, wide, bins)]);
+}
+
+/**
+ *  Применение таблиц на месте. Если таблицы помещаются в локальную память (lut_local),
+ *  группа сначала копирует их туда
+ **/
+kernel void apply_lut(global uchar* data, uint n, uint wide, uint tables, uint bins, global const ushort* lut,
+    local ushort* cache, uint lut_local) {
+    const uint size = tables * bins;
+    if (lut_local) {
+        for (uint c = get_local_id(0); c < size; c += get_local_size(0))
+            cache[c] = lut[c];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    for (uint i = get_global_id(0); i < n; i += get_global_size(0)) {
+        const uint k = (tables == 3 ? i % 3 : 0) * bins + sample(data, i, wide, bins);
+        const ushort v = lut_local ? cache[k] : lut[k];
+        if (wide) {
+            data[2 * i] = (uchar)(v >> 8);
+            data[2 * i + 1] = (uchar)v;
+        }
+        else
+            data[i] = (uchar)v;
+    }
+}
@@ -1,179 +1,1076 @@
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
 #include <math.h>
 #include <omp.h>
 #include <chrono>
+#include <string.h>
+#include "contrast.h"
+#include "histogram.h"
+#include "pnm_io.h"
+#include "pnm_codec.h"
+#ifdef USE_OPENCL
+#include "ocl_utils.h"
+#endif
+
+#define BENCH_REPEATS 10
+#define STREAM_SLOTS 3
+#define STREAM_WINDOW_MB 256
+#define HEADER_MAX 4096
+#define SEQUENCE_WINDOW 8
+#define LOCAL_TILES 8
+#define LOCAL_CLIP 3.0
+#define SAMPLE_RATE 0.01
+#define SAMPLE_TOLERANCE 0.005
+#define OCL_GROUP 256
+#define OCL_GROUPS_PER_UNIT 4
 
 /**
- *	@param a   
- *	@param n  
- *	@param colors  
+ *	Отображает файл в память и разбирает заголовок. Сжатый файл (gzip, zstd - по сигнатуре)
+ *	распаковывается в анонимное отображение, текстовый растр P2/P3 переводится в двоичный;
+ *	такие отображения подменяют file, у текстового растра h.offset тогда 0, заголовок для записи - P5/P6.
+ *	Отсчёты больше colors в испорченном двоичном растре обрезаются в такой же копии
+ *	@param size Количество отсчётов
+ *	@param bytes Размер растра: по байту на отсчёт при colors < 256, иначе по два
  **/
-void brightness_linear(short* a, int n, int colors) {
-	int* count = (int*)malloc(colors * sizeof(int));
-
-	for (int i = 0; i < colors; i++)
-		count[i] = 0;
-
-	for (int i = 0; i < n; i++)
-		count[a[i]]++;
-
-	int max = 0;
-	int min = colors;
-
-	int p = n / (colors + 1);
-
-	int start = 0, k = 0;
-	while (start < p)
-		start += count[k++];
-	int startClr = k;
-	int end = 0;
-	k = colors - 1;
-	while (end < p)
-		end += count[k--];
-	int endClr = k;
-
-	// init min max
-	max = startClr;
-	min = endClr;
-
-	// find min max
-	for (int i = 0; i < n; i++) {
-		if (a[i] > startClr && a[i] < endClr) {
-			if (max < a[i])
-				max = a[i];
-			if (min > a[i])
-				min = a[i];
+bool open_image(const char* path, mapped_file& file, pnm_header& h, int& size, size_t& bytes, int num_threads) {
+	if (!map_read(path, file)) {
+		printf_s("File not found\n");
+		return false;
+	}
+	const codec_type packing = detect_codec(file.data, file.size);
+	if (packing != CODEC_NONE) {
+		mapped_file plain;
+		bool ok = codec_available(packing);
+		if (!ok)
+			printf_s("%s support is not built in\n", codec_name(packing));
+		else if (!(ok = decompress(file, packing, plain, num_threads)))
+			printf_s("Corrupted %s data\n", codec_name(packing));
+		unmap(file);
+		if (!ok)
+			return false;
+		file = plain;
+	}
+	if (!parse_header(file.data, file.size, h)) {
+		printf_s("Invalid header\n");
+		unmap(file);
+		return false;
+	}
+	if ((long long)h.width * h.height * h.channels > 0x7fffffff) {
+		printf_s("Image is too large\n");
+		unmap(file);
+		return false;
+	}
+	size = h.width * h.height * h.channels;
+	bytes = (size_t)size * (h.colors > 255 ? 2 : 1);
+	if (h.ascii) {
+		mapped_file raster;
+		if (!map_alloc(bytes, raster)) {
+			printf_s("Not enough memory\n");
+			unmap(file);
+			return false;
 		}
+		const bool ok = decode_ascii(file.data + h.offset, file.size - h.offset, h, raster.data, num_threads);
+		unmap(file);
+		file = raster;
+		h.offset = 0;
+		if (!ok) {
+			printf_s("Raster is truncated or malformed\n");
+			unmap(file);
+			return false;
+		}
+	}
+	if (h.offset + bytes > file.size) {
+		printf_s("Raster is truncated\n");
+		unmap(file);
+		return false;
+	}
+	// отсчёты больше colors бывают только в испорченном двоичном файле (текстовый их уже обрезал);
+	// их тоже обрезаем, чтобы все режимы видели правильный растр. При 255 и 65535 проверять нечего
+	const long long above = h.ascii || h.colors == 255 || h.colors == 65535 ? 0 :
+		count_above_max(file.data + h.offset, h, num_threads);
+	if (above > 0) {
+		mapped_file raster;
+		if (!map_alloc(bytes, raster)) {
+			printf_s("Not enough memory\n");
+			unmap(file);
+			return false;
+		}
+		clamp_raster(file.data + h.offset, h, raster.data, num_threads);
+		unmap(file);
+		file = raster;
+		h.offset = 0;
+		printf_s("%lld sample(s) above maxval %i clamped\n", above, h.colors);
+	}
+	return true;
+}
+
+/**
+ *	Создаёт выходной файл размером header + bytes, отображённый для записи, и пишет в него заголовок.
+ *	При имени .gz/.zst вместо файла создаётся анонимное отображение, его сжимает и записывает close_image
+ **/
+bool create_image(const char* path, const std::string& header, size_t bytes, mapped_file& out) {
+	const codec_type packing = codec_for_path(path);
+	if (!codec_available(packing)) {
+		printf_s("%s support is not built in\n", codec_name(packing));
+		return false;
+	}
+	if (packing != CODEC_NONE ? !map_alloc(header.size() + bytes, out)
+		: !map_write(path, header.size() + bytes, out)) {
+		printf_s("File not created\n");
+		return false;
 	}
-	float mn = max - min;
+	memcpy(out.data, header.c_str(), header.size());
+	return true;
+}
+
+// сжатие (если create_image создал анонимное отображение) и закрытие выходного файла
+bool close_image(const char* path, mapped_file& out, int num_threads) {
+	const codec_type packing = codec_for_path(path);
+	bool ok = true;
+	if (packing != CODEC_NONE && !(ok = compress_file(path, packing, out.data, out.size, num_threads)))
+		printf_s("File not created\n");
+	unmap(out);
+	return ok;
+}
 
-	for (int i = 0; i < n; i++) {
-		short t = (a[i] - min) * colors / mn;
-		a[i] = t > 255 ? 255 : (abs)(t);
+template <typename T>
+void bench_histogram(const T* a, int size, int colors, int num_threads) {
+	int* expected = (int*)malloc((colors + 1) * sizeof(int));
+	int* count = (int*)malloc((colors + 1) * sizeof(int));
+	histogram_linear(a, size, colors, expected);
+
+	const char* names[] = { "linear", "shared", "private" };
+	for (int v = 0; v < 3; v++) {
+		long long best = -1;
+		for (int r = 0; r < BENCH_REPEATS; r++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			if (v == 0)
+				histogram_linear(a, size, colors, count);
+			else if (v == 1)
+				histogram_shared(a, size, colors, count, num_threads);
+			else
+				histogram_parallel(a, size, colors, count, num_threads);
+			auto end = std::chrono::high_resolution_clock::now();
+			const long long delta = (end - start) / std::chrono::microseconds(1);
+			if (best < 0 || delta < best)
+				best = delta;
+		}
+		const bool ok = memcmp(count, expected, (colors + 1) * sizeof(int)) == 0;
+		printf_s("%-8s (%i thread(s)): %lld mcs%s\n", names[v], v ? num_threads : 1, best, ok ? "" : " WRONG");
 	}
+	free(expected);
 	free(count);
 }
 
-void brightness_parallel(short* a, int n, int colors, int num_threads) {
-	int* count = (int*)malloc(colors * sizeof(int));
+// сравнение способов построения гистограммы на одном изображении, лучшее из BENCH_REPEATS
+int bench_histogram(const char* path, int num_threads) {
+	mapped_file file;
+	pnm_header h;
+	int size;
+	size_t bytes;
+	if (!open_image(path, file, h, size, bytes, num_threads))
+		return 1;
+	if (h.colors > 255) {
+		const unsigned short* raw = (const unsigned short*)(file.data + h.offset);
+		unsigned short* mat = (unsigned short*)malloc(bytes);
+		swap_bytes(raw, mat, size, num_threads);
+		bench_histogram(mat, size, h.colors, num_threads);
 
-#pragma omp parallel num_threads(num_threads)
-	{
-#pragma omp for schedule(static)
-		for (int i = 0; i < colors; i++)
-			count[i] = 0;
+		// двухуровневая гистограмма сравнивается по результату contrast_params
+		int* count = (int*)malloc((h.colors + 1) * sizeof(int));
+		int min, max, expected_min, expected_max;
+		histogram_parallel(mat, size, h.colors, count, num_threads);
+		contrast_params(count, size, h.colors, expected_min, expected_max);
+		long long best = -1;
+		for (int r = 0; r < BENCH_REPEATS; r++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			histogram16(raw, size, h.colors, 1, count, num_threads);
+			auto end = std::chrono::high_resolution_clock::now();
+			const long long delta = (end - start) / std::chrono::microseconds(1);
+			if (best < 0 || delta < best)
+				best = delta;
+		}
+		contrast_params(count, size, h.colors, min, max);
+		const bool ok = min == expected_min && max == expected_max;
+		printf_s("%-8s (%i thread(s)): %lld mcs%s\n", "two-level", num_threads, best, ok ? "" : " WRONG");
+		free(count);
+		free(mat);
 	}
+	else
+		bench_histogram(file.data + h.offset, size, h.colors, num_threads);
+	unmap(file);
+	return 0;
+}
+
+// отсчёты блока больше colors (испорченный файл) обрезаются, как в open_image
+template <typename T>
+void clamp_block(T* p, int m, int colors, int num_threads) {
+	if (colors == (sizeof(T) == 1 ? 255 : 65535))
+		return;
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+	for (int i = 0; i < m; i++)
+		if (p[i] > colors)
+			p[i] = (T)colors;
+}
+
+/**
+ *	Двухпроходная обработка изображений, не помещающихся в память. Первый проход читает
+ *	растр блоками и накапливает гистограмму, второй пропускает блоки через таблицу
+ *	и пишет их. Буферов STREAM_SLOTS по block отсчётов: пока блок обрабатывается,
+ *	следующий читается, а предыдущий пишется отдельными потоками
+ *	@param size Количество отсчётов
+ *	@param block Отсчётов в блоке, кратно tables
+ **/
+template <typename T>
+bool stream_contrast(std::ifstream& in, std::ofstream& out, long long size, int colors, int tables,
+	int num_threads, int block) {
+	const int team = num_threads == -1 ? 1 : num_threads;
+	const std::streamoff offset = in.tellg();
+	const long long blocks = (size + block - 1) / block;
+	T* slot[STREAM_SLOTS];
+	for (int k = 0; k < STREAM_SLOTS; k++)
+		slot[k] = (T*)malloc((size_t)block * sizeof(T));
 
+	auto length = [&](long long b) {
+		return (int)(size - b * block < block ? size - b * block : block);
+	};
+	bool read_ok = true, write_ok = true;
+	auto read_block = [&](long long b) {
+		in.read((char*)slot[b % STREAM_SLOTS], (std::streamsize)length(b) * sizeof(T));
+		if (!in)
+			read_ok = false;
+	};
+	auto write_block = [&](long long b) {
+		out.write((const char*)slot[b % STREAM_SLOTS], (std::streamsize)length(b) * sizeof(T));
+		if (!out)
+			write_ok = false;
+	};
 
-#pragma omp parallel num_threads(num_threads)
-	{
-#pragma omp for schedule(static)
-		for (int i = 0; i < n; i++)
-			count[a[i]]++;
+	// проход 1: гистограмма
+	const int bins = tables * (colors + 1);
+	long long* total = (long long*)calloc(bins, sizeof(long long));
+	int* count = (int*)malloc(bins * sizeof(int));
+	read_block(0);
+	for (long long b = 0; b < blocks && read_ok; b++) {
+		std::thread reader;
+		if (b + 1 < blocks)
+			reader = std::thread(read_block, b + 1);
+
+		T* p = slot[b % STREAM_SLOTS];
+		const int m = length(b);
+		swap_bytes(p, p, m, team);
+		clamp_block(p, m, colors, team);
+		if (tables == 3)
+			num_threads == -1 ?
+				histogram_rgb_linear(p, m / 3, colors, count) :
+				histogram_rgb_parallel(p, m / 3, colors, count, num_threads);
+		else
+			num_threads == -1 ?
+				histogram_linear(p, m, colors, count) : histogram_parallel(p, m, colors, count, num_threads);
+		for (int c = 0; c < bins; c++)
+			total[c] += count[c];
+
+		if (reader.joinable())
+			reader.join();
 	}
 
-	int max = 0;
-	int min = colors;
+	const int lut_size = colors < LUT_SIZE ? LUT_SIZE : colors + 1;
+	T* lut = (T*)malloc(tables * lut_size * sizeof(T));
+	contrast_lut(total, size / tables, colors, tables, lut, lut_size);
+	free(total);
+	free(count);
 
-	int p = n / (colors + 1);
+	// проход 2: чтение следующего блока, таблица для текущего, запись предыдущего
+	in.clear();
+	in.seekg(offset);
+	if (read_ok)
+		read_block(0);
+	for (long long b = 0; b < blocks && read_ok && write_ok; b++) {
+		std::thread reader, writer;
+		if (b + 1 < blocks)
+			reader = std::thread(read_block, b + 1);
+		if (b > 0)
+			writer = std::thread(write_block, b - 1);
 
-	int start = 0, k = 0;
-	while (start < p)
-		start += count[k++];
-	int startClr = k;
-	int end = 0;
-	k = colors - 1;
-	while (end < p)
-		end += count[k--];
-	int endClr = k;
+		T* p = slot[b % STREAM_SLOTS];
+		const int m = length(b);
+		swap_bytes(p, p, m, team);
+		clamp_block(p, m, colors, team);
+		tables == 3 ? apply_lut_rgb(p, p, m / 3, lut, lut_size, team) : apply_lut(p, p, m, lut, team);
+		swap_bytes(p, p, m, team);
 
-	// init min max
-	max = startClr;
-	min = endClr;
+		if (reader.joinable())
+			reader.join();
+		if (writer.joinable())
+			writer.join();
+	}
+	if (read_ok && write_ok && blocks > 0)
+		write_block(blocks - 1);
 
-	// find min max
-	for (int i = 0; i < n; i++) {
-		if (a[i] > startClr && a[i] < endClr) {
-			if (max < a[i])
-				max = a[i];
-			if (min > a[i])
-				min = a[i];
-		}
+	free(lut);
+	for (int k = 0; k < STREAM_SLOTS; k++)
+		free(slot[k]);
+	return read_ok && write_ok;
+}
+
+/**
+ *	Потоковый режим: в памяти одновременно не больше window_mb мегабайт растра
+ **/
+int brightness_stream(const char* in_path, const char* out_path, int num_threads, bool per_channel,
+	int window_mb) {
+	std::ifstream in(in_path, std::ios::binary);
+	if (!in) {
+		printf_s("File not found\n");
+		return 1;
+	}
+	char head[HEADER_MAX];
+	in.read(head, HEADER_MAX);
+	pnm_header h;
+	if (detect_codec((const unsigned char*)head, (size_t)in.gcount()) != CODEC_NONE
+		|| codec_for_path(out_path) != CODEC_NONE) {
+		printf_s("Compressed files are not supported in streaming mode\n");
+		return 1;
 	}
-	float mn = max - min;
+	if (!parse_header((const unsigned char*)head, (size_t)in.gcount(), h)) {
+		printf_s("Invalid header\n");
+		return 1;
+	}
+	if (h.ascii) {
+		printf_s("Text rasters (P2/P3) are not supported in streaming mode\n");
+		return 1;
+	}
+	in.clear();
+	in.seekg(0, std::ios::end);
+	const long long file_size = in.tellg();
+	in.seekg(h.offset);
+
+	const int sample = h.colors > 255 ? 2 : 1;
+	const long long size = (long long)h.width * h.height * h.channels;
+	if ((long long)h.offset + size * sample > file_size) {
+		printf_s("Raster is truncated\n");
+		return 1;
+	}
+
+	std::ofstream out(out_path, std::ios::binary);
+	if (!out) {
+		printf_s("File not created\n");
+		return 1;
+	}
+	const std::string header = header_string(h);
+	out.write(header.c_str(), header.size());
+
+	// блок - целое число линий кэша, но не больше 1 ГБ, чтобы количество отсчётов влезало в int
+	long long block_bytes = (long long)window_mb * 1024 * 1024 / STREAM_SLOTS / 64 * 64;
+	if (block_bytes < 64)
+		block_bytes = 64;
+	if (block_bytes > (1 << 30))
+		block_bytes = 1 << 30;
+	const int tables = per_channel && h.channels == 3 ? 3 : 1;
+	// блок из целых пикселей, чтобы каналы не сдвигались от блока к блоку
+	const int block = (int)(block_bytes / sample / tables * tables);
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const bool ok = sample == 2 ?
+		stream_contrast<unsigned short>(in, out, size, h.colors, tables, num_threads, block) :
+		stream_contrast<unsigned char>(in, out, size, h.colors, tables, num_threads, block);
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	if (!ok) {
+		printf_s("I/O error\n");
+		return 1;
+	}
+	const long long delta = (end - start) / std::chrono::microseconds(1);
+	printf_s("\nTime (%i thread(s), %s, stream %i MB): %lld mcs\n", num_threads, simd_name(detect_simd()),
+		window_mb, delta);
+	return 0;
+}
+
+// как считаются параметры цветного изображения: общие, по каналам RGB или по яркости
+enum color_mode { COLOR_COMBINED, COLOR_CHANNELS, COLOR_LUMA };
+
+/**
+ *	Обрабатывает один файл: вход и выход отображаются в память, заголовок и растр
+ *	сразу пишутся в отображение выходного файла
+ *	@param color Для локального контраста и цепочки операций COLOR_LUMA означает общие параметры
+ *	@param bytes Размер растра
+ *	@param time Время обработки без открытия файлов, мкс
+ **/
+bool contrast_file(const char* in_path, const char* out_path, int num_threads, color_mode color,
+	size_t& bytes, long long& time, const tile_grid* local = NULL, const std::vector<point_op>* ops = NULL,
+	const histogram_sampling* sampling = NULL) {
+	mapped_file in;
+	pnm_header h;
+	int size;
+	if (!open_image(in_path, in, h, size, bytes, num_threads))
+		return false;
+
+	const std::string header = header_string(h);
+	mapped_file out;
+	if (!create_image(out_path, header, bytes, out)) {
+		unmap(in);
+		return false;
+	}
+
+	const size_t stride = (size_t)h.width * h.channels * (h.colors > 255 ? 2 : 1);
+	const image_view source = { in.data + h.offset, h.width, h.height, stride, h.channels, h.colors, true };
+	const image_view target = { out.data + header.size(), h.width, h.height, stride, h.channels, h.colors, true };
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const bool per_channel = color == COLOR_CHANNELS;
+	sampling_report report;
+	if (local)
+		local_contrast(source, target, per_channel, *local, num_threads);
+	else if (ops)
+		point_pipeline(source, target, per_channel, ops->data(), (int)ops->size(), num_threads);
+	else if (color == COLOR_LUMA)
+		luma_contrast(source, target, num_threads);
+	else if (sampling) {
+		int min[3], max[3];
+		contrast_limits_sampled(source, per_channel, *sampling, min, max, &report, num_threads);
+		contrast_apply(source, target, per_channel, min, max, num_threads);
+	}
+	else
+		auto_contrast(source, target, per_channel, num_threads);
+
+	auto end = std::chrono::high_resolution_clock::now();
+	time = (end - start) / std::chrono::microseconds(1);
+
+	if (sampling) {
+		if (report.samples == 0)
+			printf_s("Sampling: exact histogram used\n");
+		else
+			printf_s("Sampling: %lld samples per table, threshold error <= %.5f, limits uncertain by %i with probability %.3f%s\n",
+				report.samples, report.epsilon, report.cut_error, 1 - report.delta,
+				report.exact ? ", too wide: exact histogram used" : "");
+	}
+
+	unmap(in);
+	return close_image(out_path, out, num_threads);
+}
+
+#ifdef USE_OPENCL
+/**
+ *	Автоконтраст на OpenCL-девайсе (кернелы из contrast.cl). Растр копируется в буфер
+ *	в закреплённой памяти (CL_MEM_ALLOC_HOST_PTR, на интегрированных GPU - без копирования
+ *	на девайс), гистограммы рабочих групп строятся в локальной памяти и атомарно
+ *	сливаются в общую, границы и таблицы считаются на хосте, таблицы применяются
+ *	на месте, результат читается через отображение того же буфера
+ **/
+bool contrast_opencl(const char* in_path, const char* out_path, bool per_channel, int device_number,
+	size_t& bytes, long long& time) {
+	mapped_file in;
+	pnm_header h;
+	int size;
+	if (!open_image(in_path, in, h, size, bytes, omp_get_max_threads()))
+		return false;
+
+	const std::string header = header_string(h);
+	mapped_file out;
+	if (!create_image(out_path, header, bytes, out)) {
+		unmap(in);
+		return false;
+	}
+
+	int total_devices = getDevices();
+	if (total_devices == 0)
+		error("No devices found. Check OpenCL installation!\n");
+	if (device_number < 0 || device_number >= total_devices)
+		device_number = 0;
+	cl_device_id device = all_devices[device_number];
+	char name[256];
+	cl_uint units;
+	cl_ulong local_memory;
+	size_t max_group;
+	clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_memory), &local_memory, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_group), &max_group, NULL);
+
+	cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, NULL);
+	cl_command_queue queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, NULL);
+	cl_program program = getProgram("contrast.cl", context);
+	buildProgram(program, device);
+	cl_kernel histogramLocal = createKernel(program, "histogram_local");
+	cl_kernel histogramGlobal = createKernel(program, "histogram_global");
+	cl_kernel applyKernel = createKernel(program, "apply_lut");
+
+	const cl_uint n = (cl_uint)size;
+	const cl_uint wide = h.colors > 255;
+	const cl_uint tables = per_channel && h.channels == 3 ? 3 : 1;
+	const cl_uint bins = h.colors + 1;
+	const size_t count_size = tables * bins * sizeof(cl_uint);
+	const size_t lut_size = tables * bins * sizeof(cl_ushort);
+	const size_t local = max_group < OCL_GROUP ? max_group : OCL_GROUP;
+	const size_t global = local * units * OCL_GROUPS_PER_UNIT;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	cl_int err;
+	const cl_mem bufData = createBuffer(context, bytes, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+	unsigned char* pinned = (unsigned char*)clEnqueueMapBuffer(queue, bufData, CL_TRUE, CL_MAP_WRITE, 0, bytes,
+		0, NULL, NULL, &err);
+	if (err != 0)
+		error("Error: map buffer");
+	memcpy(pinned, in.data + h.offset, bytes);
+	clEnqueueUnmapMemObject(queue, bufData, pinned, 0, NULL, NULL);
 
-#pragma omp parallel num_threads(num_threads)
-	{
-#pragma omp for schedule(static)
-		for (int i = 0; i < n; i++) {
-			short t = (a[i] - min) * colors / mn;
-			a[i] = t > 255 ? 255 : (abs)(t);
+	const cl_mem bufCount = createBuffer(context, count_size, CL_MEM_READ_WRITE);
+	const cl_uint zero = 0;
+	clEnqueueFillBuffer(queue, bufCount, &zero, sizeof(zero), 0, count_size, 0, NULL, NULL);
+
+	// 16-битные гистограммы обычно не помещаются в локальную память, тогда атомарные операции идут в глобальную
+	const bool histogram_local = count_size <= local_memory;
+	cl_kernel histogramKernel = histogram_local ? histogramLocal : histogramGlobal;
+	clSetKernelArg(histogramKernel, 0, sizeof(bufData), &bufData);
+	clSetKernelArg(histogramKernel, 1, sizeof(cl_uint), &n);
+	clSetKernelArg(histogramKernel, 2, sizeof(cl_uint), &wide);
+	clSetKernelArg(histogramKernel, 3, sizeof(cl_uint), &tables);
+	clSetKernelArg(histogramKernel, 4, sizeof(cl_uint), &bins);
+	clSetKernelArg(histogramKernel, 5, sizeof(bufCount), &bufCount);
+	if (histogram_local)
+		clSetKernelArg(histogramKernel, 6, count_size, NULL);
+	cl_event histogramEvent;
+	clEnqueueNDRangeKernel(queue, histogramKernel, 1, NULL, &global, &local, 0, NULL, &histogramEvent);
+
+	std::vector<cl_uint> count(tables * bins);
+	clEnqueueReadBuffer(queue, bufCount, CL_TRUE, 0, count_size, count.data(), 0, NULL, NULL);
+
+	// границы и таблицы - как в auto_contrast
+	std::vector<long long> count64(count.begin(), count.end());
+	const image_view view = { NULL, h.width, h.height, 0, h.channels, h.colors, true };
+	int min[3], max[3];
+	contrast_limits(view, per_channel, count64.data(), min, max);
+	std::vector<cl_ushort> lut(tables * bins);
+	std::vector<unsigned char> lut8(bins);
+	for (cl_uint t = 0; t < tables; t++)
+		if (wide)
+			build_lut(min[t], max[t], h.colors, lut.data() + t * bins, bins);
+		else {
+			build_lut(min[t], max[t], h.colors, lut8.data(), bins);
+			std::copy(lut8.begin(), lut8.end(), lut.begin() + t * bins);
+		}
+	const cl_mem bufLut = createBuffer(context, lut_size, CL_MEM_READ_ONLY);
+	clEnqueueWriteBuffer(queue, bufLut, CL_FALSE, 0, lut_size, lut.data(), 0, NULL, NULL);
+
+	const cl_uint lut_local = lut_size <= local_memory;
+	clSetKernelArg(applyKernel, 0, sizeof(bufData), &bufData);
+	clSetKernelArg(applyKernel, 1, sizeof(cl_uint), &n);
+	clSetKernelArg(applyKernel, 2, sizeof(cl_uint), &wide);
+	clSetKernelArg(applyKernel, 3, sizeof(cl_uint), &tables);
+	clSetKernelArg(applyKernel, 4, sizeof(cl_uint), &bins);
+	clSetKernelArg(applyKernel, 5, sizeof(bufLut), &bufLut);
+	clSetKernelArg(applyKernel, 6, lut_local ? lut_size : sizeof(cl_ushort), NULL);
+	clSetKernelArg(applyKernel, 7, sizeof(cl_uint), &lut_local);
+	cl_event applyEvent;
+	clEnqueueNDRangeKernel(queue, applyKernel, 1, NULL, &global, &local, 0, NULL, &applyEvent);
+
+	pinned = (unsigned char*)clEnqueueMapBuffer(queue, bufData, CL_TRUE, CL_MAP_READ, 0, bytes, 0, NULL, NULL, &err);
+	if (err != 0)
+		error("Error: map buffer");
+	memcpy(out.data + header.size(), pinned, bytes);
+	clEnqueueUnmapMemObject(queue, bufData, pinned, 0, NULL, NULL);
+	clFinish(queue);
+
+	auto end = std::chrono::high_resolution_clock::now();
+	time = (end - start) / std::chrono::microseconds(1);
+	printf_s("OpenCL (%s): histogram %.3f ms (%s memory), apply %.3f ms\n", name, getTime(histogramEvent),
+		histogram_local ? "local" : "global", getTime(applyEvent));
+
+	clReleaseEvent(histogramEvent);
+	clReleaseEvent(applyEvent);
+	clReleaseMemObject(bufData);
+	clReleaseMemObject(bufCount);
+	clReleaseMemObject(bufLut);
+	clReleaseKernel(histogramLocal);
+	clReleaseKernel(histogramGlobal);
+	clReleaseKernel(applyKernel);
+	clReleaseProgram(program);
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+	unmap(in);
+	return close_image(out_path, out, omp_get_max_threads());
+}
+#endif
+
+// PNM-файлы каталога по имени или пути из списка, по одному в строке
+bool list_images(const char* source, std::vector<std::string>& files) {
+	namespace fs = std::filesystem;
+	std::error_code error;
+	if (fs::is_directory(source, error)) {
+		for (const auto& entry : fs::directory_iterator(source, error)) {
+			// у сжатых файлов тип изображения - расширение перед .gz/.zst
+			fs::path name = entry.path().filename();
+			if (codec_for_path(name.string().c_str()) != CODEC_NONE)
+				name = name.stem();
+			const std::string ext = name.extension().string();
+			if (entry.is_regular_file() && (ext == ".pgm" || ext == ".ppm" || ext == ".pnm" || ext == ".pam"))
+				files.push_back(entry.path().string());
 		}
+		std::sort(files.begin(), files.end());
+		return true;
 	}
-	free(count);
+	std::ifstream list(source);
+	if (!list) {
+		printf_s("File not found\n");
+		return false;
+	}
+	std::string line;
+	while (std::getline(list, line))
+		if (!line.empty() && line[0] != '#')
+			files.push_back(line);
+	return true;
 }
 
-int main(int argc, char* argv[]) {
-	if (argc > 3) {
-		int n;
-		int n2;
-		int colors;
-		std::ifstream in(argv[1], std::ios::binary);
-		if (!in) {
-			printf_s("File not found\n");
-			return 1;
+/**
+ *	Пакетный режим: все PNM-файлы каталога (или файлы из списка, по одному пути в строке)
+ *	обрабатываются одним процессом. Несколько изображений идут одновременно, у каждого
+ *	inner потоков: при большом количестве изображений выгоднее параллелить по ним,
+ *	при малом - внутри изображения
+ *	@param inner Потоков на изображение, 0 - выбрать по количеству изображений
+ **/
+int batch_contrast(const char* source, const char* out_dir, int num_threads, int inner, color_mode color) {
+	namespace fs = std::filesystem;
+	std::vector<std::string> files;
+	if (!list_images(source, files))
+		return 1;
+	const int images = (int)files.size();
+	if (images == 0) {
+		printf_s("No images\n");
+		return 1;
+	}
+	std::error_code error;
+	fs::create_directories(out_dir, error);
+
+	if (inner <= 0)
+		inner = images >= num_threads ? 1 : num_threads / images;
+	int outer = num_threads / inner;
+	if (outer < 1) outer = 1;
+	if (outer > images) outer = images;
+	omp_set_nested(1);
+	// выбор SIMD кэшируется до запуска потоков
+	detect_simd();
+
+	long long total_bytes = 0;
+	int failed = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+
+#pragma omp parallel for num_threads(outer) schedule(dynamic, 1) reduction(+: total_bytes, failed)
+	for (int i = 0; i < images; i++) {
+		const std::string out_path = (fs::path(out_dir) / fs::path(files[i]).filename()).string();
+		size_t bytes;
+		long long time;
+		if (contrast_file(files[i].c_str(), out_path.c_str(), inner == 1 ? -1 : inner, color, bytes, time))
+			total_bytes += bytes;
+		else
+			failed++;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	const double seconds = (end - start) / std::chrono::microseconds(1) / 1e6;
+
+	printf_s("\nBatch (%i x %i thread(s), %s): %i image(s), %i failed, %.3f s, %.1f images/s, %.1f MB/s\n",
+		outer, inner, simd_name(detect_simd()), images, failed, seconds, (images - failed) / seconds,
+		total_bytes / 1048576.0 / seconds);
+	return failed ? 1 : 0;
+}
+
+/**
+ *	Разбор списка операций через запятую: stretch, gamma=<g>, invert, threshold=<t>, lut=<файл>.
+ *	Файл таблицы - целые числа через пробел, таблицы хранятся в tables
+ **/
+bool parse_ops(const char* list, std::vector<point_op>& ops, std::vector<std::vector<int>>& tables) {
+	std::string rest = list;
+	// ops хранит указатели на таблицы: вектор таблиц не должен перераспределяться
+	tables.reserve(rest.size());
+	while (!rest.empty()) {
+		const size_t comma = rest.find(',');
+		const std::string item = rest.substr(0, comma);
+		rest = comma == std::string::npos ? "" : rest.substr(comma + 1);
+		const size_t eq = item.find('=');
+		const std::string name = item.substr(0, eq);
+		const std::string arg = eq == std::string::npos ? "" : item.substr(eq + 1);
+
+		point_op op = { POINT_STRETCH, 0, NULL, 0 };
+		if (name == "stretch")
+			op.type = POINT_STRETCH;
+		else if (name == "gamma" && !arg.empty())
+			op = { POINT_GAMMA, atof(arg.c_str()), NULL, 0 };
+		else if (name == "invert")
+			op.type = POINT_INVERT;
+		else if (name == "threshold" && !arg.empty())
+			op = { POINT_THRESHOLD, atof(arg.c_str()), NULL, 0 };
+		else if (name == "lut" && !arg.empty()) {
+			std::ifstream file(arg);
+			if (!file) {
+				printf_s("File not found\n");
+				return false;
+			}
+			tables.emplace_back();
+			int x;
+			while (file >> x)
+				tables.back().push_back(x);
+			op = { POINT_TABLE, 0, tables.back().data(), (int)tables.back().size() };
+		}
+		else {
+			printf_s("Unknown operation: %s\n", item.c_str());
+			return false;
 		}
+		ops.push_back(op);
+	}
+	return true;
+}
 
-		int num_threads = atoi(argv[3]);
-		if (num_threads == 0) num_threads = omp_get_max_threads();
-		std::string format;
-		std::getline(in, format);
+// кадр последовательности: отображения входа и выхода и его собственная гистограмма
+struct frame {
+	mapped_file in;
+	mapped_file out;
+	std::string out_path;
+	image_view source;
+	image_view target;
+	long long* count;
+	size_t bytes;
+	bool ok;
+};
 
-		in >> n;
-		in >> n2;
-		in >> colors;
+void load_frame(const std::string& in_path, const std::string& out_path, bool per_channel, int num_threads,
+	frame& f) {
+	f.ok = false;
+	f.count = NULL;
+	pnm_header h;
+	int size;
+	if (!open_image(in_path.c_str(), f.in, h, size, f.bytes, num_threads))
+		return;
+	const std::string header = header_string(h);
+	if (!create_image(out_path.c_str(), header, f.bytes, f.out)) {
+		unmap(f.in);
+		return;
+	}
+	f.out_path = out_path;
 
-		char ma;
-		short* mat4 = (short*)malloc(n * n2 * 3 * sizeof(short));
-		char* mat = (char*)malloc(n * n2 * 3 * sizeof(char));
-		in.read(mat, n * n2 * 3);
-		for (int i = 0; i < n * n2 * 3; i++)
-			mat4[i] = (unsigned char)mat[i];
-		in.close();
+	const size_t stride = (size_t)h.width * h.channels * (h.colors > 255 ? 2 : 1);
+	f.source = { f.in.data + h.offset, h.width, h.height, stride, h.channels, h.colors, true };
+	f.target = { f.out.data + header.size(), h.width, h.height, stride, h.channels, h.colors, true };
+	f.count = (long long*)malloc(contrast_tables(f.source, per_channel) * (h.colors + 1) * sizeof(long long));
+	contrast_histogram(f.source, per_channel, f.count, num_threads);
+	f.ok = true;
+}
 
-		auto start = std::chrono::high_resolution_clock::now();
+void release_frame(frame& f, int num_threads) {
+	if (!f.ok)
+		return;
+	free(f.count);
+	close_image(f.out_path.c_str(), f.out, num_threads);
+	unmap(f.in);
+	f.ok = false;
+}
 
-		num_threads == -1 ?
-			brightness_linear(mat4, n * n2 * 3, colors) : brightness_parallel(mat4, n, colors, num_threads);
+/**
+ *	Последовательность кадров со сглаженными во времени параметрами. Параметры считаются
+ *	по скользящей сумме гистограмм последних window кадров (прибавляется новый кадр,
+ *	вычитается выпавший) или, при decay > 0, по экспоненциально затухающей гистограмме
+ *	h = decay * h + (1 - decay) * h_кадра. Пересчёт параметров стоит O(maxval) на кадр.
+ *	Пока кадр t растягивается, отдельный поток открывает кадр t + 1 и строит его гистограмму
+ **/
+int sequence_contrast(const char* source, const char* out_dir, int num_threads, int window, double decay,
+	bool per_channel) {
+	namespace fs = std::filesystem;
+	std::vector<std::string> files;
+	if (!list_images(source, files))
+		return 1;
+	const int frames = (int)files.size();
+	if (frames == 0) {
+		printf_s("No images\n");
+		return 1;
+	}
+	std::error_code error;
+	fs::create_directories(out_dir, error);
+	detect_simd();
+	auto out_path = [&](int t) {
+		return (fs::path(out_dir) / fs::path(files[t]).filename()).string();
+	};
 
-		auto end = std::chrono::high_resolution_clock::now();
+	// состояние сглаживания; сбрасывается, если формат кадра поменялся
+	int bins = 0, tables = 0, filled = 0, oldest = 0;
+	long long samples = 0;
+	double* smooth = NULL;
+	long long* sum = NULL;
+	std::vector<long long*> ring;
 
-		const auto delta = (end - start) / std::chrono::microseconds(1);
+	long long total_bytes = 0;
+	int failed = 0;
+	auto start = std::chrono::high_resolution_clock::now();
 
-		printf_s("\nTime (%i thread(s)): %d mcs\n", num_threads, delta);
+	// пока загрузчик строит гистограмму следующего кадра, основной поток применяет таблицы
+	// к текущему: потоки делятся между ними, чтобы две команды OpenMP не делили одни ядра
+	const int loader_threads = num_threads / 2 > 1 ? num_threads / 2 : 1;
+	const int apply_threads = num_threads - loader_threads > 1 ? num_threads - loader_threads : 1;
 
-		std::ofstream out(argv[2], std::ios::binary);
-		if (!out) {
-			printf_s("File not created\n");
-			return 1;
+	frame cur{}, next{};
+	load_frame(files[0], out_path(0), per_channel, num_threads, cur);
+	for (int t = 0; t < frames; t++) {
+		std::thread loader;
+		if (t + 1 < frames)
+			loader = std::thread(load_frame, files[t + 1], out_path(t + 1), per_channel, loader_threads,
+				std::ref(next));
+
+		if (cur.ok) {
+			const image_view& v = cur.source;
+			const int frame_tables = contrast_tables(v, per_channel);
+			const long long frame_samples = (long long)v.width * v.height * v.channels / frame_tables;
+			if (frame_tables != tables || v.maxval + 1 != bins || frame_samples != samples) {
+				free(smooth);
+				free(sum);
+				for (size_t k = 0; k < ring.size(); k++)
+					free(ring[k]);
+				ring.clear();
+				tables = frame_tables;
+				bins = v.maxval + 1;
+				samples = frame_samples;
+				filled = oldest = 0;
+				smooth = decay > 0 ? (double*)malloc(tables * bins * sizeof(double)) : NULL;
+				sum = decay > 0 ? NULL : (long long*)calloc(tables * bins, sizeof(long long));
+				for (int k = 0; decay <= 0 && k < window; k++)
+					ring.push_back((long long*)malloc(tables * bins * sizeof(long long)));
+			}
+
+			int min[3], max[3];
+			if (decay > 0) {
+				for (int c = 0; c < tables * bins; c++)
+					smooth[c] = filled ? decay * smooth[c] + (1 - decay) * cur.count[c] : (double)cur.count[c];
+				filled = 1;
+				for (int k = 0; k < tables; k++)
+					contrast_params(smooth + k * bins, samples, bins - 1, min[k], max[k]);
+			}
+			else {
+				// выпавший из окна кадр вычитается, новый прибавляется
+				long long* slot = ring[oldest];
+				for (int c = 0; c < tables * bins; c++) {
+					sum[c] += cur.count[c] - (filled == window ? slot[c] : 0);
+					slot[c] = cur.count[c];
+				}
+				oldest = (oldest + 1) % window;
+				if (filled < window)
+					filled++;
+				for (int k = 0; k < tables; k++)
+					contrast_params(sum + k * bins, samples * filled, bins - 1, min[k], max[k]);
+			}
+			contrast_apply(cur.source, cur.target, per_channel, min, max, apply_threads);
+			total_bytes += cur.bytes;
 		}
-		format += "\n";
-		out.write(format.c_str(), format.size());
+		else
+			failed++;
+		release_frame(cur, apply_threads);
+
+		if (loader.joinable())
+			loader.join();
+		cur = next;
+	}
 
-		std::string temp = std::to_string(n) + " " + std::to_string(n2) + "\n" + std::to_string(colors);
-		out.write(temp.c_str(), temp.size());
+	auto end = std::chrono::high_resolution_clock::now();
+	const double seconds = (end - start) / std::chrono::microseconds(1) / 1e6;
 
+	free(smooth);
+	free(sum);
+	for (size_t k = 0; k < ring.size(); k++)
+		free(ring[k]);
 
-		for (int i = 0; i < n * n2 * 3; i++) {
-			mat[i] = mat4[i];
+	if (decay > 0)
+		printf_s("\nSequence (decay %g, %i thread(s), %s): ", decay, num_threads, simd_name(detect_simd()));
+	else
+		printf_s("\nSequence (window %i, %i thread(s), %s): ", window, num_threads, simd_name(detect_simd()));
+	printf_s("%i frame(s), %i failed, %.3f s, %.1f frames/s, %.1f MB/s\n", frames, failed, seconds,
+		(frames - failed) / seconds, total_bytes / 1048576.0 / seconds);
+	return failed ? 1 : 0;
+}
+
+/**
+ *	auto_contrast 16-битной полосы (values[i] повторяется repeats[i] раз) против таблицы
+ *	по полной гистограмме. Значения больше colors (испорченный файл) должны считаться равными colors
+ **/
+bool selftest_layout(const char* name, const int* values, const int* repeats, int k, int colors, int num_threads) {
+	int n = 0;
+	for (int i = 0; i < k; i++)
+		n += repeats[i];
+	unsigned char* in = (unsigned char*)malloc(2 * (size_t)n);
+	unsigned char* out = (unsigned char*)malloc(2 * (size_t)n);
+	int* count = (int*)calloc(colors + 1, sizeof(int));
+	unsigned short* lut = (unsigned short*)malloc((colors + 1) * sizeof(unsigned short));
+	for (int i = 0, j = 0; i < k; i++)
+		for (int r = 0; r < repeats[i]; r++, j++) {
+			in[2 * j] = (unsigned char)(values[i] >> 8);
+			in[2 * j + 1] = (unsigned char)values[i];
+			count[values[i] > colors ? colors : values[i]]++;
 		}
+	int min, max;
+	contrast_params(count, n, colors, min, max);
+	build_lut(min, max, colors, lut, colors + 1);
 
-		out.write(mat, n * n2 * 3 * sizeof(char));
-		free(mat);
-		out.close();
+	const image_view source = { in, n, 1, 2 * (size_t)n, 1, colors, true };
+	const image_view target = { out, n, 1, 2 * (size_t)n, 1, colors, true };
+	auto_contrast(source, target, false, num_threads);
+	int wrong = 0;
+	for (int j = 0; j < n; j++)
+		if ((out[2 * j] << 8 | out[2 * j + 1]) != lut[clamp_sample(in[2 * j] << 8 | in[2 * j + 1], colors)])
+			wrong++;
+	printf_s("%-40s min %i max %i: %s\n", name, min, max, wrong ? "WRONG" : "ok");
+	free(lut);
+	free(count);
+	free(out);
+	free(in);
+	return wrong == 0;
+}
+
+/**
+ *	Проверки на построенных в памяти изображениях. Двухуровневая гистограмма: порог + 1 -
+ *	единственное значение первой непустой корзины за порогом, min (max) - в следующей корзине.
+ *	Последняя полоса - испорченный файл с отсчётами больше maxval
+ **/
+int selftest(int num_threads) {
+	const int low_values[] = { 15, 16, 40, 50000, 60000 };
+	const int low_repeats[] = { 2, 1, 65536, 65531, 2 };
+	const int high_values[] = { 100, 5000, 30000, 65000, 65519, 65520 };
+	const int high_repeats[] = { 2, 65530, 1, 65536, 1, 2 };
+	const int both_values[] = { 15, 16, 40, 65000, 65519, 65520 };
+	const int both_repeats[] = { 2, 1, 65533, 65533, 1, 2 };
+	const int above_values[] = { 0, 10, 500, 990, 1000, 60000 };
+	const int above_repeats[] = { 5, 20, 3000, 20, 5, 40 };
+	bool ok = selftest_layout("histogram16: min behind threshold + 1", low_values, low_repeats, 5, 65535, num_threads);
+	ok &= selftest_layout("histogram16: max behind threshold - 1", high_values, high_repeats, 6, 65535, num_threads);
+	ok &= selftest_layout("histogram16: both sides", both_values, both_repeats, 6, 65535, num_threads);
+	ok &= selftest_layout("histogram16: samples above maxval", above_values, above_repeats, 6, 1000, num_threads);
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc > 2 && strcmp(argv[1], "--bench") == 0) {
+		int num_threads = argc > 3 ? atoi(argv[3]) : 0;
+		if (num_threads <= 0) num_threads = omp_get_max_threads();
+		return bench_histogram(argv[2], num_threads);
+	}
+
+	if (argc > 1 && strcmp(argv[1], "--selftest") == 0) {
+		int num_threads = argc > 2 ? atoi(argv[2]) : 0;
+		if (num_threads <= 0) num_threads = omp_get_max_threads();
+		return selftest(num_threads);
+	}
+
+	if (argc > 3 && strcmp(argv[1], "--sequence") == 0) {
+		bool per_channel = false;
+		int window = SEQUENCE_WINDOW;
+		double decay = 0;
+		std::vector<const char*> args;
+		for (int i = 2; i < argc; i++)
+			if (strcmp(argv[i], "--channels") == 0)
+				per_channel = true;
+			else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+				window = atoi(argv[++i]);
+			else if (strcmp(argv[i], "--decay") == 0 && i + 1 < argc)
+				decay = atof(argv[++i]);
+			else
+				args.push_back(argv[i]);
+		int num_threads = args.size() > 2 ? atoi(args[2]) : 0;
+		if (num_threads == 0) num_threads = omp_get_max_threads();
+		if (window < 1) window = 1;
+		if (decay >= 1) decay = 0;
+		if (args.size() >= 2)
+			return sequence_contrast(args[0], args[1], num_threads, window, decay, per_channel);
+	}
+
+	if (argc > 3 && strcmp(argv[1], "--batch") == 0) {
+		color_mode color = COLOR_COMBINED;
+		std::vector<const char*> args;
+		for (int i = 2; i < argc; i++)
+			if (strcmp(argv[i], "--channels") == 0)
+				color = COLOR_CHANNELS;
+			else if (strcmp(argv[i], "--luma") == 0)
+				color = COLOR_LUMA;
+			else
+				args.push_back(argv[i]);
+		int num_threads = args.size() > 2 ? atoi(args[2]) : 0;
+		if (num_threads <= 0) num_threads = omp_get_max_threads();
+		const int inner = args.size() > 3 ? atoi(args[3]) : 0;
+		if (args.size() >= 2)
+			return batch_contrast(args[0], args[1], num_threads, inner, color);
+	}
+
+	if (argc > 3) {
+		int num_threads = atoi(argv[3]);
+		if (num_threads == 0) num_threads = omp_get_max_threads();
+
+		bool per_channel = false, luma = false, stream = false, local = false, sample = false, ocl = false;
+		int device_number = 0;
+		histogram_sampling sampling = { SAMPLE_RATE, 1, SAMPLE_TOLERANCE };
+		std::vector<point_op> ops;
+		std::vector<std::vector<int>> op_tables;
+		int window_mb = STREAM_WINDOW_MB;
+		tile_grid grid = { LOCAL_TILES, LOCAL_TILES, LOCAL_CLIP };
+		for (int i = 4; i < argc; i++) {
+			if (strcmp(argv[i], "--channels") == 0)
+				per_channel = true;
+			else if (strcmp(argv[i], "--luma") == 0)
+				luma = true;
+			else if (strcmp(argv[i], "--stream") == 0) {
+				stream = true;
+				if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+					window_mb = atoi(argv[++i]);
+			}
+			else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+				if (!parse_ops(argv[++i], ops, op_tables))
+					return 1;
+			}
+			else if (strcmp(argv[i], "--ocl") == 0) {
+				ocl = true;
+				if (i + 1 < argc && argv[i + 1][0] != '-')
+					device_number = atoi(argv[++i]);
+			}
+			else if (strcmp(argv[i], "--sample") == 0) {
+				sample = true;
+				if (i + 1 < argc && atof(argv[i + 1]) > 0)
+					sampling.rate = atof(argv[++i]);
+				if (i + 1 < argc && argv[i + 1][0] != '-')
+					sampling.seed = (unsigned)atoi(argv[++i]);
+			}
+			else if (strcmp(argv[i], "--local") == 0) {
+				local = true;
+				if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+					grid.tiles_x = grid.tiles_y = atoi(argv[++i]);
+				if (i + 1 < argc && argv[i + 1][0] != '-')
+					grid.clip = atof(argv[++i]);
+			}
+		}
+		if (stream)
+			return brightness_stream(argv[1], argv[2], num_threads, per_channel, window_mb);
+
+		size_t bytes;
+		long long delta;
+#ifdef USE_OPENCL
+		if (ocl) {
+			if (!contrast_opencl(argv[1], argv[2], per_channel, device_number, bytes, delta))
+				return 1;
+			printf_s("\nTime (OpenCL): %lld mcs\n", delta);
+			return 0;
+		}
+#else
+		if (ocl) {
+			printf_s("Built without OpenCL, --ocl %i is not available\n", device_number);
+			return 1;
+		}
+#endif
+		const color_mode color = luma ? COLOR_LUMA : per_channel ? COLOR_CHANNELS : COLOR_COMBINED;
+		if (!contrast_file(argv[1], argv[2], num_threads, color, bytes, delta, local ? &grid : NULL,
+			ops.empty() ? NULL : &ops, sample ? &sampling : NULL))
+			return 1;
+
+		printf_s("\nTime (%i thread(s), %s): %lld mcs\n", num_threads, simd_name(detect_simd()), delta);
 	}
 	else
-		printf_s(": \n\tConsoleApplication1.exe <__> <__> <-_>");
+		printf_s("Использование: \n\tConsoleApplication1.exe <имя_входного_файла> <имя_выходного_файла> <кол-во_потоков> [--channels | --luma] [--stream [<окно_МБ>] | --local [<тайлов_по_стороне> [<клип>]] | --ops <операция>[,<операция>...] | --sample [<доля> [<seed>]] | --ocl [<номер_девайса>]]\n\tConsoleApplication1.exe --batch <каталог|список> <выходной_каталог> [<кол-во_потоков> [<потоков_на_изображение>]] [--channels | --luma]\n\tConsoleApplication1.exe --sequence <каталог|список> <выходной_каталог> [<кол-во_потоков>] [--window <кадров> | --decay <коэффициент>] [--channels]\n\tConsoleApplication1.exe --bench <имя_входного_файла> [<кол-во_потоков>]\n\tConsoleApplication1.exe --selftest [<кол-во_потоков>]");
 	return 0;
 }
\ No newline at end of file
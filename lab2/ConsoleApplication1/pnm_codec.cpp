@@ -0,0 +1,370 @@
+#include "pnm_codec.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// несжатый размер блока при записи
+#define CODEC_BLOCK (1 << 20)
+#define GZIP_LEVEL 6
+#define ZSTD_LEVEL 3
+// длина заголовка члена gzip с полем FEXTRA из одного подполя 'P' 'Z' и 4 байт размера
+#define GZIP_HEADER 20
+#define GZIP_TRAILER 8
+
+// блок сжатого файла: где лежит и куда распаковывается
+struct codec_block {
+	size_t in_offset;
+	size_t in_size;
+	size_t out_offset;
+	size_t out_size;
+};
+
+static unsigned read_le(const unsigned char* p, int bytes) {
+	unsigned value = 0;
+	for (int i = bytes - 1; i >= 0; i--)
+		value = value << 8 | p[i];
+	return value;
+}
+
+static void write_le(unsigned char* p, unsigned value, int bytes) {
+	for (int i = 0; i < bytes; i++)
+		p[i] = (unsigned char)(value >> (8 * i));
+}
+
+codec_type detect_codec(const unsigned char* data, size_t size) {
+	if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+		return CODEC_GZIP;
+	if (size >= 4 && read_le(data, 4) == 0xfd2fb528)
+		return CODEC_ZSTD;
+	return CODEC_NONE;
+}
+
+codec_type codec_for_path(const char* path) {
+	const size_t length = strlen(path);
+	if (length >= 3 && strcmp(path + length - 3, ".gz") == 0)
+		return CODEC_GZIP;
+	if (length >= 4 && strcmp(path + length - 4, ".zst") == 0)
+		return CODEC_ZSTD;
+	return CODEC_NONE;
+}
+
+bool codec_available(codec_type codec) {
+	switch (codec) {
+	case CODEC_NONE:
+		return true;
+#ifdef HAVE_ZLIB
+	case CODEC_GZIP:
+		return true;
+#endif
+#ifdef HAVE_ZSTD
+	case CODEC_ZSTD:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char* codec_name(codec_type codec) {
+	return codec == CODEC_GZIP ? "gzip" : codec == CODEC_ZSTD ? "zstd" : "none";
+}
+
+// заменяет out отображением capacity байт с первыми used байтами прежнего
+static bool resize(mapped_file& out, size_t used, size_t capacity) {
+	mapped_file bigger;
+	if (!map_alloc(capacity, bigger))
+		return false;
+	if (used > 0)
+		memcpy(bigger.data, out.data, used);
+	unmap(out);
+	out = bigger;
+	return true;
+}
+
+// распаковка по блокам с известными размерами, каждый блок в своё место
+static bool decompress_blocks(const mapped_file& in, codec_type codec, std::vector<codec_block>& blocks,
+	mapped_file& out, int num_threads) {
+	size_t total = 0;
+	for (size_t i = 0; i < blocks.size(); i++) {
+		blocks[i].out_offset = total;
+		total += blocks[i].out_size;
+	}
+	if (!map_alloc(total, out))
+		return false;
+
+	const int count = (int)blocks.size();
+	if (num_threads < 1)
+		num_threads = 1;
+	int failed = 0;
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1) reduction(+: failed)
+	for (int i = 0; i < count; i++) {
+		const codec_block& b = blocks[i];
+		if (b.out_size == 0)
+			continue;
+#ifdef HAVE_ZLIB
+		if (codec == CODEC_GZIP) {
+			z_stream s;
+			memset(&s, 0, sizeof(s));
+			// 16 + 15: член gzip целиком, zlib сам сверяет CRC32 и ISIZE
+			if (inflateInit2(&s, 16 + 15) != Z_OK) {
+				failed++;
+				continue;
+			}
+			s.next_in = (Bytef*)(in.data + b.in_offset);
+			s.avail_in = (uInt)b.in_size;
+			s.next_out = out.data + b.out_offset;
+			s.avail_out = (uInt)b.out_size;
+			if (inflate(&s, Z_FINISH) != Z_STREAM_END || s.total_out != b.out_size)
+				failed++;
+			inflateEnd(&s);
+		}
+#endif
+#ifdef HAVE_ZSTD
+		if (codec == CODEC_ZSTD) {
+			const size_t result = ZSTD_decompress(out.data + b.out_offset, b.out_size, in.data + b.in_offset,
+				b.in_size);
+			if (ZSTD_isError(result) || result != b.out_size)
+				failed++;
+		}
+#endif
+	}
+	if (failed) {
+		unmap(out);
+		return false;
+	}
+	return true;
+}
+
+#ifdef HAVE_ZLIB
+/**
+ *	Разбивает файл на члены gzip по размеру из FEXTRA: своё подполе 'P' 'Z' (4 байта, размер члена)
+ *	или 'B' 'C' у bgzip (2 байта, размер минус 1). Несжатый размер - ISIZE в конце члена
+ **/
+static bool gzip_members(const unsigned char* data, size_t size, std::vector<codec_block>& blocks) {
+	size_t pos = 0;
+	while (pos < size) {
+		if (size - pos < 12 || data[pos] != 0x1f || data[pos + 1] != 0x8b || data[pos + 2] != 8
+			|| !(data[pos + 3] & 4))
+			return false;
+		const size_t extra = read_le(data + pos + 10, 2);
+		if (size - pos < 12 + extra)
+			return false;
+		size_t member = 0;
+		for (size_t f = pos + 12; f + 4 <= pos + 12 + extra; f += 4 + read_le(data + f + 2, 2)) {
+			const unsigned length = read_le(data + f + 2, 2);
+			if (data[f] == 'P' && data[f + 1] == 'Z' && length == 4 && f + 8 <= pos + 12 + extra)
+				member = read_le(data + f + 4, 4);
+			else if (data[f] == 'B' && data[f + 1] == 'C' && length == 2 && f + 6 <= pos + 12 + extra)
+				member = read_le(data + f + 4, 2) + 1;
+		}
+		if (member < 12 + extra + GZIP_TRAILER || member > size - pos)
+			return false;
+		const codec_block b = { pos, member, 0, read_le(data + pos + member - 4, 4) };
+		blocks.push_back(b);
+		pos += member;
+	}
+	return true;
+}
+
+// поток из любого числа членов gzip; ISIZE последнего - точный размер для обычного одночленного файла
+static bool gzip_stream(const mapped_file& in, mapped_file& out) {
+	size_t capacity = in.size >= 4 ? read_le(in.data + in.size - 4, 4) : 0;
+	if (capacity < in.size)
+		capacity = in.size * 4;
+	if (!map_alloc(capacity, out))
+		return false;
+
+	z_stream s;
+	memset(&s, 0, sizeof(s));
+	// 32 + 15: заголовок gzip или zlib определяется автоматически
+	if (inflateInit2(&s, 32 + 15) != Z_OK) {
+		unmap(out);
+		return false;
+	}
+	size_t used = 0, in_pos = 0;
+	bool ok = true;
+	for (;;) {
+		if (used == capacity && !resize(out, used, capacity *= 2)) {
+			ok = false;
+			break;
+		}
+		// размеры zlib 32-битные, поэтому и вход, и выход подаются порциями
+		const size_t in_part = in.size - in_pos < (1u << 30) ? in.size - in_pos : (1u << 30);
+		const size_t out_part = capacity - used < (1u << 30) ? capacity - used : (1u << 30);
+		s.next_in = (Bytef*)(in.data + in_pos);
+		s.avail_in = (uInt)in_part;
+		s.next_out = out.data + used;
+		s.avail_out = (uInt)out_part;
+		const int status = inflate(&s, Z_NO_FLUSH);
+		in_pos += in_part - s.avail_in;
+		used += out_part - s.avail_out;
+		if (status == Z_STREAM_END) {
+			// следующий член, если он есть
+			if (in.size - in_pos < 2 || in.data[in_pos] != 0x1f || in.data[in_pos + 1] != 0x8b)
+				break;
+			inflateReset(&s);
+		}
+		else if (status != Z_OK && !(status == Z_BUF_ERROR && used == capacity)) {
+			ok = false;
+			break;
+		}
+	}
+	inflateEnd(&s);
+	if (ok && used != capacity)
+		ok = resize(out, used, used);
+	if (!ok)
+		unmap(out);
+	return ok;
+}
+
+static unsigned char* gzip_block(const unsigned char* data, size_t size, size_t& packed) {
+	z_stream s;
+	memset(&s, 0, sizeof(s));
+	// -15: голый deflate, заголовок с размером члена и хвост пишутся здесь
+	if (deflateInit2(&s, GZIP_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+	const size_t bound = GZIP_HEADER + deflateBound(&s, (uLong)size) + GZIP_TRAILER;
+	unsigned char* p = (unsigned char*)malloc(bound);
+	s.next_in = (Bytef*)data;
+	s.avail_in = (uInt)size;
+	s.next_out = p + GZIP_HEADER;
+	s.avail_out = (uInt)(bound - GZIP_HEADER - GZIP_TRAILER);
+	const bool ok = deflate(&s, Z_FINISH) == Z_STREAM_END;
+	packed = GZIP_HEADER + s.total_out + GZIP_TRAILER;
+	deflateEnd(&s);
+	if (!ok) {
+		free(p);
+		return NULL;
+	}
+
+	// ID1 ID2 CM FLG=FEXTRA MTIME=0 XFL=0 OS=255, XLEN=8, подполе 'P' 'Z' длиной 4 с размером члена
+	const unsigned char header[12] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255, 8, 0 };
+	memcpy(p, header, sizeof(header));
+	p[12] = 'P';
+	p[13] = 'Z';
+	write_le(p + 14, 4, 2);
+	write_le(p + 16, (unsigned)packed, 4);
+	write_le(p + packed - 8, (unsigned)crc32(0, data, (uInt)size), 4);
+	write_le(p + packed - 4, (unsigned)size, 4);
+	return p;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+// кадры zstd подряд; false, если у какого-то кадра не записан размер содержимого
+static bool zstd_frames(const unsigned char* data, size_t size, std::vector<codec_block>& blocks) {
+	size_t pos = 0;
+	while (pos < size) {
+		const size_t frame = ZSTD_findFrameCompressedSize(data + pos, size - pos);
+		const unsigned long long content = ZSTD_getFrameContentSize(data + pos, size - pos);
+		if (ZSTD_isError(frame) || content == ZSTD_CONTENTSIZE_UNKNOWN || content == ZSTD_CONTENTSIZE_ERROR)
+			return false;
+		const codec_block b = { pos, frame, 0, (size_t)content };
+		blocks.push_back(b);
+		pos += frame;
+	}
+	return true;
+}
+
+static bool zstd_stream(const mapped_file& in, mapped_file& out) {
+	size_t capacity = in.size * 4;
+	if (!map_alloc(capacity, out))
+		return false;
+	ZSTD_DStream* stream = ZSTD_createDStream();
+	ZSTD_inBuffer source = { in.data, in.size, 0 };
+	size_t used = 0, pending = 1;
+	bool ok = stream != NULL;
+	// pending != 0: кадр не закончен или в потоке остались данные для выхода
+	while (ok && (source.pos < source.size || pending != 0)) {
+		if (used == capacity && !resize(out, used, capacity *= 2)) {
+			ok = false;
+			break;
+		}
+		const size_t before = source.pos;
+		ZSTD_outBuffer target = { out.data + used, capacity - used, 0 };
+		pending = ZSTD_decompressStream(stream, &target, &source);
+		// без продвижения при свободном выходе - вход обрезан
+		ok = !ZSTD_isError(pending) && (target.pos > 0 || source.pos > before);
+		used += target.pos;
+	}
+	ZSTD_freeDStream(stream);
+	if (ok && used != capacity)
+		ok = resize(out, used, used);
+	if (!ok)
+		unmap(out);
+	return ok;
+}
+#endif
+
+bool decompress(const mapped_file& in, codec_type codec, mapped_file& out, int num_threads) {
+	std::vector<codec_block> blocks;
+#ifdef HAVE_ZLIB
+	if (codec == CODEC_GZIP)
+		return gzip_members(in.data, in.size, blocks) ? decompress_blocks(in, codec, blocks, out, num_threads)
+			: gzip_stream(in, out);
+#endif
+#ifdef HAVE_ZSTD
+	if (codec == CODEC_ZSTD)
+		return zstd_frames(in.data, in.size, blocks) ? decompress_blocks(in, codec, blocks, out, num_threads)
+			: zstd_stream(in, out);
+#endif
+	return false;
+}
+
+bool compress_file(const char* path, codec_type codec, const unsigned char* data, size_t size, int num_threads) {
+	if (!codec_available(codec) || codec == CODEC_NONE)
+		return false;
+	const int count = (int)((size + CODEC_BLOCK - 1) / CODEC_BLOCK);
+	std::vector<unsigned char*> packed(count, NULL);
+	std::vector<size_t> packed_size(count, 0);
+	if (num_threads < 1)
+		num_threads = 1;
+
+	int failed = 0;
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1) reduction(+: failed)
+	for (int i = 0; i < count; i++) {
+		const size_t offset = (size_t)i * CODEC_BLOCK;
+		const size_t length = size - offset < CODEC_BLOCK ? size - offset : CODEC_BLOCK;
+#ifdef HAVE_ZLIB
+		if (codec == CODEC_GZIP)
+			packed[i] = gzip_block(data + offset, length, packed_size[i]);
+#endif
+#ifdef HAVE_ZSTD
+		if (codec == CODEC_ZSTD) {
+			const size_t bound = ZSTD_compressBound(length);
+			packed[i] = (unsigned char*)malloc(bound);
+			// простой ZSTD_compress записывает размер содержимого в заголовок кадра
+			packed_size[i] = ZSTD_compress(packed[i], bound, data + offset, length, ZSTD_LEVEL);
+			if (ZSTD_isError(packed_size[i])) {
+				free(packed[i]);
+				packed[i] = NULL;
+			}
+		}
+#endif
+		if (packed[i] == NULL)
+			failed++;
+	}
+
+	size_t total = 0;
+	for (int i = 0; i < count; i++)
+		total += packed_size[i];
+	mapped_file out;
+	const bool ok = !failed && map_write(path, total, out);
+	if (ok) {
+		size_t offset = 0;
+		for (int i = 0; i < count; i++) {
+			memcpy(out.data + offset, packed[i], packed_size[i]);
+			offset += packed_size[i];
+		}
+		unmap(out);
+	}
+	for (int i = 0; i < count; i++)
+		free(packed[i]);
+	return ok;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+#include "pnm_io.h"
+
+// gzip собирается с HAVE_ZLIB (zlib), zstd - с HAVE_ZSTD (libzstd)
+enum codec_type {
+	CODEC_NONE,
+	CODEC_GZIP,
+	CODEC_ZSTD
+};
+
+// по сигнатуре в начале данных: 1f 8b - gzip, 28 b5 2f fd - zstd
+codec_type detect_codec(const unsigned char* data, size_t size);
+
+// по расширению имени: .gz или .zst
+codec_type codec_for_path(const char* path);
+
+bool codec_available(codec_type codec);
+
+const char* codec_name(codec_type codec);
+
+/**
+ *	Распаковывает файл целиком в анонимное отображение out. Файлы, записанные compress_file,
+ *	состоят из независимых блоков с известными размерами (члены gzip с размером в поле FEXTRA,
+ *	как у bgzip, или кадры zstd с размером содержимого) и распаковываются параллельно, каждый блок
+ *	в своё место. Остальные распаковываются последовательно
+ **/
+bool decompress(const mapped_file& in, codec_type codec, mapped_file& out, int num_threads);
+
+/**
+ *	Сжимает data параллельно блоками по CODEC_BLOCK байт и записывает в файл path.
+ *	Каждый блок - отдельный член gzip или кадр zstd, поэтому файл читается обычными gunzip/zstd
+ **/
+bool compress_file(const char* path, codec_type codec, const unsigned char* data, size_t size, int num_threads);
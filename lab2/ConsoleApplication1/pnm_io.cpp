@@ -0,0 +1,444 @@
+#include "pnm_io.h"
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define PNM_SSE2
+#include <emmintrin.h>
+#endif
+
+// текст короче этого на поток не делится
+#define ASCII_MIN_PART 65536
+
+#ifdef _WIN32
+static bool map_handle(HANDLE file, size_t size, bool write, mapped_file& m) {
+	m.file = file;
+	m.size = size;
+	m.mapping = NULL;
+	m.data = NULL;
+	if (size == 0)
+		return true;
+	m.mapping = CreateFileMappingA(file, NULL, write ? PAGE_READWRITE : PAGE_READONLY,
+		(DWORD)((unsigned long long)size >> 32), (DWORD)size, NULL);
+	if (m.mapping != NULL)
+		m.data = (unsigned char*)MapViewOfFile(m.mapping, write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+	if (m.data == NULL) {
+		unmap(m);
+		return false;
+	}
+	return true;
+}
+
+bool map_read(const char* path, mapped_file& m) {
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+	return map_handle(file, (size_t)size.QuadPart, false, m);
+}
+
+bool map_write(const char* path, size_t size, mapped_file& m) {
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	// CreateFileMapping с ненулевым размером сам растягивает файл
+	return map_handle(file, size, true, m);
+}
+
+bool map_alloc(size_t size, mapped_file& m) {
+	return map_handle(INVALID_HANDLE_VALUE, size, true, m);
+}
+
+void unmap(mapped_file& m) {
+	if (m.data != NULL)
+		UnmapViewOfFile(m.data);
+	if (m.mapping != NULL)
+		CloseHandle(m.mapping);
+	if (m.file != INVALID_HANDLE_VALUE)
+		CloseHandle(m.file);
+	m.data = NULL;
+	m.mapping = NULL;
+	m.file = INVALID_HANDLE_VALUE;
+}
+#else
+static bool map_fd(int fd, size_t size, bool write, mapped_file& m) {
+	m.fd = fd;
+	m.size = size;
+	m.data = NULL;
+	if (size == 0)
+		return true;
+	void* p = mmap(NULL, size, write ? PROT_READ | PROT_WRITE : PROT_READ,
+		write ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		unmap(m);
+		return false;
+	}
+	m.data = (unsigned char*)p;
+	if (!write)
+		madvise(p, size, MADV_SEQUENTIAL);
+	return true;
+}
+
+bool map_read(const char* path, mapped_file& m) {
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	return map_fd(fd, (size_t)st.st_size, false, m);
+}
+
+bool map_write(const char* path, size_t size, mapped_file& m) {
+	const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, (off_t)size) != 0) {
+		close(fd);
+		return false;
+	}
+	return map_fd(fd, size, true, m);
+}
+
+bool map_alloc(size_t size, mapped_file& m) {
+	m.fd = -1;
+	m.size = size;
+	m.data = NULL;
+	if (size == 0)
+		return true;
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return false;
+	m.data = (unsigned char*)p;
+	return true;
+}
+
+void unmap(mapped_file& m) {
+	if (m.data != NULL)
+		munmap(m.data, m.size);
+	if (m.fd >= 0)
+		close(m.fd);
+	m.data = NULL;
+	m.fd = -1;
+}
+#endif
+
+static bool is_space(unsigned char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// пробельные символы и комментарии от '#' до конца строки
+static void skip_space(const unsigned char* data, size_t size, size_t& pos) {
+	while (pos < size) {
+		if (data[pos] == '#')
+			while (pos < size && data[pos] != '\n' && data[pos] != '\r')
+				pos++;
+		else if (is_space(data[pos]))
+			pos++;
+		else
+			break;
+	}
+}
+
+static bool read_int(const unsigned char* data, size_t size, size_t& pos, int& value) {
+	skip_space(data, size, pos);
+	if (pos == size || data[pos] < '0' || data[pos] > '9')
+		return false;
+	value = 0;
+	while (pos < size && data[pos] >= '0' && data[pos] <= '9') {
+		if (value > 0x7fffffff / 10 - 1)
+			return false;
+		value = value * 10 + (data[pos++] - '0');
+	}
+	return true;
+}
+
+static std::string read_word(const unsigned char* data, size_t size, size_t& pos) {
+	skip_space(data, size, pos);
+	const size_t start = pos;
+	while (pos < size && !is_space(data[pos]))
+		pos++;
+	return std::string((const char*)data + start, pos - start);
+}
+
+// строки "КЛЮЧ значение" до ENDHDR; растр начинается со следующей строки
+static bool parse_pam(const unsigned char* data, size_t size, size_t pos, pnm_header& h) {
+	h.width = h.height = h.colors = h.channels = 0;
+	for (;;) {
+		const std::string key = read_word(data, size, pos);
+		if (key == "ENDHDR") {
+			while (pos < size && data[pos] != '\n')
+				pos++;
+			if (pos == size)
+				return false;
+			h.offset = pos + 1;
+			break;
+		}
+		if (key == "TUPLTYPE") {
+			// значение - остаток строки, несколько строк TUPLTYPE склеиваются через пробел
+			while (pos < size && (data[pos] == ' ' || data[pos] == '\t'))
+				pos++;
+			const size_t start = pos;
+			while (pos < size && data[pos] != '\n' && data[pos] != '\r')
+				pos++;
+			size_t end = pos;
+			while (end > start && is_space(data[end - 1]))
+				end--;
+			if (!h.tuple_type.empty())
+				h.tuple_type += " ";
+			h.tuple_type.append((const char*)data + start, end - start);
+		}
+		else if (key == "WIDTH") {
+			if (!read_int(data, size, pos, h.width))
+				return false;
+		}
+		else if (key == "HEIGHT") {
+			if (!read_int(data, size, pos, h.height))
+				return false;
+		}
+		else if (key == "DEPTH") {
+			if (!read_int(data, size, pos, h.channels))
+				return false;
+		}
+		else if (key == "MAXVAL") {
+			if (!read_int(data, size, pos, h.colors))
+				return false;
+		}
+		else
+			return false;
+	}
+	// прозрачность (GRAYSCALE_ALPHA, RGB_ALPHA) и прочие глубины не поддерживаются
+	return h.channels == 1 || h.channels == 3;
+}
+
+bool parse_header(const unsigned char* data, size_t size, pnm_header& h) {
+	size_t pos = 0;
+	while (pos < size && !is_space(data[pos]))
+		pos++;
+	h.format.assign((const char*)data, pos);
+	h.tuple_type.clear();
+	h.ascii = h.format == "P2" || h.format == "P3";
+
+	if (h.format == "P7") {
+		if (!parse_pam(data, size, pos, h))
+			return false;
+	}
+	else {
+		if (!h.ascii && h.format != "P5" && h.format != "P6")
+			return false;
+		h.channels = h.format == "P2" || h.format == "P5" ? 1 : 3;
+		if (!read_int(data, size, pos, h.width) || !read_int(data, size, pos, h.height)
+			|| !read_int(data, size, pos, h.colors))
+			return false;
+		// текстовый растр может начинаться с любого количества пробельных символов и комментариев
+		if (h.ascii) {
+			skip_space(data, size, pos);
+			h.offset = pos;
+		}
+		else {
+			if (pos == size || !is_space(data[pos]))
+				return false;
+			h.offset = pos + 1;
+		}
+	}
+	return h.width > 0 && h.height > 0 && h.colors > 0 && h.colors < 65536;
+}
+
+std::string header_string(const pnm_header& h) {
+	if (h.format == "P7")
+		return "P7\nWIDTH " + std::to_string(h.width) + "\nHEIGHT " + std::to_string(h.height)
+			+ "\nDEPTH " + std::to_string(h.channels) + "\nMAXVAL " + std::to_string(h.colors) + "\n"
+			+ (h.tuple_type.empty() ? std::string() : "TUPLTYPE " + h.tuple_type + "\n") + "ENDHDR\n";
+	const std::string format = h.format == "P2" ? "P5" : h.format == "P3" ? "P6" : h.format;
+	return format + "\n" + std::to_string(h.width) + " " + std::to_string(h.height) + "\n"
+		+ std::to_string(h.colors) + "\n";
+}
+
+static int bit_count(unsigned long long x) {
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+static int lowest_bit(unsigned long long x) {
+#ifdef _MSC_VER
+	unsigned long k;
+	if (_BitScanForward(&k, (unsigned long)x))
+		return (int)k;
+	_BitScanForward(&k, (unsigned long)(x >> 32));
+	return (int)k + 32;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+/**
+ *	Маски n <= 64 байт: цифры и символы, не являющиеся ни цифрой, ни пробельным.
+ *	Полные блоки сравниваются SSE2 по 16 байт, биты за n нулевые
+ **/
+static void scan_block(const unsigned char* p, size_t n, unsigned long long& digits,
+	unsigned long long& other) {
+	digits = 0;
+	unsigned long long spaces = 0;
+#ifdef PNM_SSE2
+	if (n == 64) {
+		// беззнаковое c - base < range через знаковое сравнение со сдвигом на 0x80
+		const __m128i bias = _mm_set1_epi8((char)0x80);
+		for (int k = 0; k < 4; k++) {
+			const __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+			const __m128i d = _mm_cmplt_epi8(_mm_xor_si128(_mm_sub_epi8(v, _mm_set1_epi8('0')), bias),
+				_mm_set1_epi8((char)(0x80 + 10)));
+			const __m128i s = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+				_mm_cmplt_epi8(_mm_xor_si128(_mm_sub_epi8(v, _mm_set1_epi8('\t')), bias),
+					_mm_set1_epi8((char)(0x80 + 5))));
+			digits |= (unsigned long long)(unsigned)_mm_movemask_epi8(d) << (16 * k);
+			spaces |= (unsigned long long)(unsigned)_mm_movemask_epi8(s) << (16 * k);
+		}
+		other = ~(digits | spaces);
+		return;
+	}
+#endif
+	for (size_t i = 0; i < n; i++) {
+		if (p[i] >= '0' && p[i] <= '9')
+			digits |= 1ULL << i;
+		else if (is_space(p[i]))
+			spaces |= 1ULL << i;
+	}
+	other = ~(digits | spaces) & (n == 64 ? ~0ULL : (1ULL << n) - 1);
+}
+
+// количество чисел в куске; перед куском и после него пробельный символ или граница текста
+static bool count_tokens(const unsigned char* p, size_t size, long long& count) {
+	count = 0;
+	unsigned long long carry = 0;
+	for (size_t i = 0; i < size; i += 64) {
+		unsigned long long digits, other;
+		scan_block(p + i, size - i < 64 ? size - i : 64, digits, other);
+		if (other)
+			return false;
+		count += bit_count(digits & ~(digits << 1 | carry));
+		carry = digits >> 63;
+	}
+	return true;
+}
+
+// разбор чисел куска в отсчёты с номера first, не дальше n
+static void parse_tokens(const unsigned char* p, size_t size, long long first, long long n, int colors,
+	unsigned char* raster) {
+	const bool wide = colors > 255;
+	long long index = first;
+	unsigned long long carry = 0;
+	for (size_t i = 0; i < size && index < n; i += 64) {
+		unsigned long long digits, other;
+		scan_block(p + i, size - i < 64 ? size - i : 64, digits, other);
+		unsigned long long starts = digits & ~(digits << 1 | carry);
+		carry = digits >> 63;
+		for (; starts != 0 && index < n; starts &= starts - 1) {
+			size_t pos = i + lowest_bit(starts);
+			unsigned value = 0;
+			// начала чисел берутся из маски, поэтому длинное число можно не дочитывать
+			while (pos < size && p[pos] >= '0' && p[pos] <= '9' && value <= 65535)
+				value = value * 10 + (p[pos++] - '0');
+			if (value > (unsigned)colors)
+				value = colors;
+			if (wide) {
+				raster[2 * index] = (unsigned char)(value >> 8);
+				raster[2 * index + 1] = (unsigned char)value;
+			}
+			else
+				raster[index] = (unsigned char)value;
+			index++;
+		}
+	}
+}
+
+bool decode_ascii(const unsigned char* text, size_t size, const pnm_header& h, unsigned char* raster,
+	int num_threads) {
+	const long long n = (long long)h.width * h.height * h.channels;
+	int parts = num_threads < 1 ? 1 : num_threads;
+	if ((size_t)parts > size / ASCII_MIN_PART + 1)
+		parts = (int)(size / ASCII_MIN_PART + 1);
+
+	// границы кусков сдвигаются вперёд до пробельного символа, чтобы не резать числа
+	std::vector<size_t> bound(parts + 1);
+	bound[0] = 0;
+	bound[parts] = size;
+	for (int k = 1; k < parts; k++) {
+		size_t b = size / parts * k;
+		if (b < bound[k - 1])
+			b = bound[k - 1];
+		while (b < size && !is_space(text[b]))
+			b++;
+		bound[k] = b;
+	}
+
+	std::vector<long long> first(parts + 1);
+	int failed = 0;
+#pragma omp parallel for num_threads(parts) schedule(static) reduction(+: failed)
+	for (int k = 0; k < parts; k++)
+		if (!count_tokens(text + bound[k], bound[k + 1] - bound[k], first[k + 1]))
+			failed++;
+	if (failed)
+		return false;
+	first[0] = 0;
+	for (int k = 0; k < parts; k++)
+		first[k + 1] += first[k];
+	if (first[parts] < n)
+		return false;
+
+#pragma omp parallel for num_threads(parts) schedule(static)
+	for (int k = 0; k < parts; k++)
+		parse_tokens(text + bound[k], bound[k + 1] - bound[k], first[k], n, h.colors, raster);
+	return true;
+}
+
+// open_image ограничивает растр 0x7fffffff отсчётами, поэтому номера отсчётов - int (OpenMP 2.0)
+static int raster_sample(const unsigned char* raster, int i, bool wide) {
+	return wide ? raster[2 * (size_t)i] << 8 | raster[2 * (size_t)i + 1] : raster[i];
+}
+
+long long count_above_max(const unsigned char* raster, const pnm_header& h, int num_threads) {
+	const int n = h.width * h.height * h.channels;
+	const bool wide = h.colors > 255;
+	long long above = 0;
+#pragma omp parallel for num_threads(num_threads < 1 ? 1 : num_threads) schedule(static) reduction(+: above)
+	for (int i = 0; i < n; i++)
+		above += raster_sample(raster, i, wide) > h.colors;
+	return above;
+}
+
+void clamp_raster(const unsigned char* raster, const pnm_header& h, unsigned char* out, int num_threads) {
+	const int n = h.width * h.height * h.channels;
+	const bool wide = h.colors > 255;
+#pragma omp parallel for num_threads(num_threads < 1 ? 1 : num_threads) schedule(static)
+	for (int i = 0; i < n; i++) {
+		int value = raster_sample(raster, i, wide);
+		if (value > h.colors)
+			value = h.colors;
+		if (wide) {
+			out[2 * (size_t)i] = (unsigned char)(value >> 8);
+			out[2 * (size_t)i + 1] = (unsigned char)value;
+		}
+		else
+			out[i] = (unsigned char)value;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+
+// файл, отображённый в память целиком
+struct mapped_file {
+	unsigned char* data;
+	size_t size;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int fd;
+#endif
+};
+
+// только чтение, страницы подгружаются по мере обращения
+bool map_read(const char* path, mapped_file& m);
+
+// создаёт (или обрезает) файл размером size байт и отображает его для записи
+bool map_write(const char* path, size_t size, mapped_file& m);
+
+// анонимное отображение size байт (в файле подкачки), освобождается тем же unmap
+bool map_alloc(size_t size, mapped_file& m);
+
+void unmap(mapped_file& m);
+
+struct pnm_header {
+	std::string format;
+	int width;
+	int height;
+	int colors;
+	// отсчётов на пиксель: 1 для P2/P5, 3 для P3/P6, DEPTH для P7
+	int channels;
+	// TUPLTYPE заголовка P7
+	std::string tuple_type;
+	// растр P2/P3: десятичные числа через пробельные символы
+	bool ascii;
+	// смещение растра от начала файла
+	size_t offset;
+};
+
+/**
+ *	Разбирает заголовок "P2|P3|P5|P6 ширина высота максимум" с комментариями от '#' до конца строки
+ *	или заголовок PAM (P7) с DEPTH 1 или 3. Двоичный растр начинается после одного пробельного
+ *	символа за максимумом (за строкой ENDHDR у P7), текстовый - сразу за максимумом
+ **/
+bool parse_header(const unsigned char* data, size_t size, pnm_header& h);
+
+// заголовок двоичного файла того же вида: P2 записывается как P5, P3 как P6
+std::string header_string(const pnm_header& h);
+
+/**
+ *	Переводит текстовый растр P2/P3 в двоичный того же вида, что у P5/P6 (16 бит старшим байтом
+ *	вперёд при colors > 255). Текст делится на куски по пробельным символам, каждый поток
+ *	считает числа своего куска по маскам цифр, затем по префиксным суммам разбирает их в своё место.
+ *	Значения больше colors обрезаются, лишние числа в конце игнорируются
+ *	@param text Начало растра, size - его длина до конца файла
+ *	@param raster width * height * channels отсчётов
+ *	@return false, если чисел меньше, чем отсчётов, или в тексте есть посторонние символы
+ **/
+bool decode_ascii(const unsigned char* text, size_t size, const pnm_header& h, unsigned char* raster,
+	int num_threads);
+
+/**
+ *	Количество отсчётов двоичного растра больше colors. В правильном файле их нет,
+ *	в испорченном они вывели бы гистограммы и таблицы за границы
+ *	@param raster width * height * channels отсчётов, не больше 0x7fffffff
+ **/
+long long count_above_max(const unsigned char* raster, const pnm_header& h, int num_threads);
+
+// копирует растр в out, заменяя отсчёты больше colors на colors, как decode_ascii
+void clamp_raster(const unsigned char* raster, const pnm_header& h, unsigned char* out, int num_threads);
@@ -0,0 +1,941 @@
+#include "contrast.h"
+#include "histogram.h"
+#include <math.h>
+
+void swap_bytes(const unsigned short* in, unsigned short* out, int n, int num_threads) {
+	const int chunks = (n + APPLY_CHUNK - 1) / APPLY_CHUNK;
+
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+	for (int c = 0; c < chunks; c++) {
+		const int begin = c * APPLY_CHUNK;
+		swap_bytes16(in + begin, out + begin, n - begin < APPLY_CHUNK ? n - begin : APPLY_CHUNK);
+	}
+}
+
+void swap_bytes(const unsigned char* in, unsigned char* out, int n, int /*num_threads*/) {
+	if (out != in)
+		memcpy(out, in, n);
+}
+
+static inline int be16(unsigned short x) {
+	return (unsigned short)((x >> 8) | (x << 8));
+}
+
+// отсчёт в порядке файла; при colors = 65535 ограничивать нечего, и сравнение в горячих циклах не нужно
+template <bool CLAMP>
+static inline int sample16(unsigned short x, int colors) {
+	return CLAMP ? clamp_sample(be16(x), colors) : be16(x);
+}
+
+/**
+ *	Двухуровневая гистограмма 16-битных отсчётов в порядке файла для contrast_params.
+ *	Первый проход - COARSE_BINS грубых корзин по старшим битам, второй - точные значения
+ *	только в корзинах, где лежат пороги отсечения, и в двух ближайших к каждому порогу непустых.
+ *	Остальные корзины пишутся в count целиком в первую ячейку: накопленные суммы на границах
+ *	корзин точные, поэтому contrast_params даёт тот же результат, что и на полной гистограмме.
+ *	Отсчёты больше colors считаются равными colors
+ *	@param n Количество отсчётов
+ *	@param tables 1 - одна гистограмма на все отсчёты, 3 - по каналам RGB
+ *	@param count tables гистограмм по colors + 1 ячеек
+ **/
+template <bool CLAMP>
+static void histogram16(const unsigned short* a, int n, int colors, int tables, int* count, int num_threads) {
+	int shift = 0;
+	while ((colors >> shift) >= COARSE_BINS)
+		shift++;
+	const int width = 1 << shift;
+	const int buckets = (colors >> shift) + 1;
+	const int pixels = n / tables;
+	const int coarse_size = tables * COARSE_BINS;
+
+	// у одной гистограммы LANES копий, у трёх каналов копиями служат сами каналы
+	const int lanes = tables == 3 ? 3 : LANES;
+	const int copy_size = lanes * COARSE_BINS;
+	int* coarse = (int*)calloc(coarse_size, sizeof(int));
+	int* local = (int*)calloc((size_t)num_threads * copy_size, sizeof(int));
+#pragma omp parallel num_threads(num_threads)
+	{
+		int* h = local + omp_get_thread_num() * copy_size;
+		const int groups = n / lanes;
+#pragma omp for schedule(static)
+		for (int q = 0; q < groups; q++) {
+			const unsigned short* g = a + q * lanes;
+			h[sample16<CLAMP>(g[0], colors) >> shift]++;
+			h[COARSE_BINS + (sample16<CLAMP>(g[1], colors) >> shift)]++;
+			h[2 * COARSE_BINS + (sample16<CLAMP>(g[2], colors) >> shift)]++;
+			if (lanes == 4)
+				h[3 * COARSE_BINS + (sample16<CLAMP>(g[3], colors) >> shift)]++;
+		}
+#pragma omp master
+		for (int i = groups * lanes; i < n; i++)
+			h[(i % lanes) * COARSE_BINS + (sample16<CLAMP>(a[i], colors) >> shift)]++;
+	}
+	for (int k = 0; k < num_threads * lanes; k++)
+		for (int c = 0; c < COARSE_BINS; c++)
+			coarse[(tables == 3 ? k % 3 : 0) * COARSE_BINS + c] += local[k * COARSE_BINS + c];
+	free(local);
+
+	// корзины с порогами и первая непустая за каждым порогом
+	int* slot = (int*)malloc(coarse_size * sizeof(int));
+	for (int c = 0; c < coarse_size; c++)
+		slot[c] = -1;
+	const int p = pixels / (colors + 1);
+	for (int t = 0; t < tables; t++) {
+		const int* c = coarse + t * COARSE_BINS;
+		int low = 0, high = buckets - 1;
+		long long sum = 0;
+		if (shift == 0)
+			continue;
+		if (p > 0) {
+			while (sum < p)
+				sum += c[low++];
+			low--;
+			sum = 0;
+			while (sum < p)
+				sum += c[high--];
+			high++;
+		}
+		// contrast_params ищет min начиная с порога + 2. Порог + 1 может оказаться единственным
+		// значением первой непустой корзины за low, тогда min лежит во второй; для max так же
+		int next = low + 1, prev = high - 1;
+		while (next < buckets - 1 && !c[next])
+			next++;
+		while (prev > 0 && !c[prev])
+			prev--;
+		int next2 = next + 1, prev2 = prev - 1;
+		while (next2 < buckets - 1 && !c[next2])
+			next2++;
+		while (prev2 > 0 && !c[prev2])
+			prev2--;
+
+		const int wanted[FINE_BUCKETS] = { low, high, next, prev, next2, prev2 };
+		int used = 0;
+		for (int k = 0; k < FINE_BUCKETS; k++)
+			if (wanted[k] >= 0 && wanted[k] < buckets && slot[t * COARSE_BINS + wanted[k]] < 0)
+				slot[t * COARSE_BINS + wanted[k]] = used++;
+	}
+
+	const int fine_size = tables * FINE_BUCKETS * width;
+	int* fine = (int*)calloc(fine_size, sizeof(int));
+	local = (int*)calloc((size_t)num_threads * fine_size, sizeof(int));
+	// при shift == 0 грубая гистограмма уже точная, второй проход не нужен
+	if (shift > 0) {
+#pragma omp parallel num_threads(num_threads)
+		{
+			int* h = local + omp_get_thread_num() * fine_size;
+#pragma omp for schedule(static)
+			for (int i = 0; i < n; i++) {
+				const int v = sample16<CLAMP>(a[i], colors);
+				const int t = tables == 3 ? i % 3 : 0;
+				const int s = slot[t * COARSE_BINS + (v >> shift)];
+				if (s >= 0)
+					h[(t * FINE_BUCKETS + s) * width + (v & (width - 1))]++;
+			}
+		}
+	}
+	for (int k = 0; k < num_threads; k++)
+		for (int c = 0; c < fine_size; c++)
+			fine[c] += local[k * fine_size + c];
+	free(local);
+
+	for (int t = 0; t < tables; t++) {
+		int* h = count + t * (colors + 1);
+		for (int v = 0; v <= colors; v++)
+			h[v] = 0;
+		for (int b = 0; b < buckets; b++) {
+			const int s = slot[t * COARSE_BINS + b];
+			if (s < 0) {
+				h[b * width] = coarse[t * COARSE_BINS + b];
+				continue;
+			}
+			for (int v = b * width; v < (b + 1) * width && v <= colors; v++)
+				h[v] = fine[(t * FINE_BUCKETS + s) * width + (v & (width - 1))];
+		}
+	}
+	free(coarse);
+	free(fine);
+	free(slot);
+}
+
+void histogram16(const unsigned short* a, int n, int colors, int tables, int* count, int num_threads) {
+	if (colors < 65535)
+		histogram16<true>(a, n, colors, tables, count, num_threads);
+	else
+		histogram16<false>(a, n, colors, tables, count, num_threads);
+}
+
+/**
+ *	16-битная обработка прямо по отсчётам в порядке файла: гистограмма histogram16,
+ *	таблица применяется вместе с перестановкой байт (lut_apply_be)
+ *	@param n Количество отсчётов
+ **/
+void brightness16(const unsigned short* a, unsigned short* out, int n, int colors, int tables, int num_threads) {
+	const int team = num_threads == -1 ? 1 : num_threads;
+	int* count = (int*)malloc(tables * (colors + 1) * sizeof(int));
+	histogram16(a, n, colors, tables, count, team);
+
+	// таблица на все 16-битные значения, чтобы отсчёты больше colors не читали за ней; +1: сборка читает по 32 бита
+	const int size = LUT16_SIZE;
+	unsigned short* lut = (unsigned short*)malloc((tables * size + 1) * sizeof(unsigned short));
+	contrast_lut(count, n / tables, colors, tables, lut, size);
+	lut[tables * size] = 0;
+	free(count);
+
+	const int unit = tables == 3 ? 3 * APPLY_CHUNK : APPLY_CHUNK;
+	const int chunks = (n + unit - 1) / unit;
+#pragma omp parallel for num_threads(team) schedule(static)
+	for (int c = 0; c < chunks; c++) {
+		const int begin = c * unit;
+		const int m = n - begin < unit ? n - begin : unit;
+		if (tables == 3)
+			lut_apply_rgb_be(a + begin, out + begin, m / 3, lut, size);
+		else
+			lut_apply_be(a + begin, out + begin, m, lut);
+	}
+	free(lut);
+}
+static int sample_size(const image_view& image) {
+	return image.maxval > 255 ? 2 : 1;
+}
+
+static bool contiguous(const image_view& image) {
+	return image.stride == (size_t)image.width * image.channels * sample_size(image);
+}
+
+static bool same_format(const image_view& a, const image_view& b) {
+	return a.width == b.width && a.height == b.height && a.channels == b.channels && a.maxval == b.maxval
+		&& a.big_endian == b.big_endian;
+}
+
+int contrast_tables(const image_view& image, bool per_channel) {
+	return per_channel && image.channels == 3 ? 3 : 1;
+}
+
+// по строкам: у каждого потока своя гистограмма, в конце они складываются
+template <typename T>
+static void rows_histogram(const image_view& image, int tables, long long* count, int num_threads) {
+	const int bins = image.maxval + 1;
+	const int size = tables * bins;
+	const int row = image.width * image.channels;
+	const bool swap = sizeof(T) == 2 && image.big_endian;
+	const int team = num_threads == -1 ? 1 : num_threads;
+	int* local = (int*)calloc((size_t)team * size, sizeof(int));
+
+#pragma omp parallel num_threads(team)
+	{
+		int* h = local + omp_get_thread_num() * size;
+#pragma omp for schedule(static)
+		for (int y = 0; y < image.height; y++) {
+			const T* p = (const T*)((const unsigned char*)image.data + y * image.stride);
+			for (int i = 0; i < row; i++) {
+				const int v = clamp_sample(swap ? be16(p[i]) : p[i], image.maxval);
+				h[(tables == 3 ? i % 3 : 0) * bins + v]++;
+			}
+		}
+	}
+	for (int c = 0; c < size; c++) {
+		long long sum = 0;
+		for (int k = 0; k < team; k++)
+			sum += local[k * size + c];
+		count[c] = sum;
+	}
+	free(local);
+}
+
+void contrast_histogram(const image_view& image, bool per_channel, long long* count, int num_threads) {
+	if (num_threads == 0) num_threads = omp_get_max_threads();
+	const int tables = contrast_tables(image, per_channel);
+	const long long n = (long long)image.width * image.height * image.channels;
+
+	// непрерывные 8-битные изображения - через подгистограммы потоков
+	if (contiguous(image) && sample_size(image) == 1 && n <= 0x7FFFFFFF) {
+		const unsigned char* a = (const unsigned char*)image.data;
+		const int bins = tables * (image.maxval + 1);
+		int* local = (int*)malloc(bins * sizeof(int));
+		if (tables == 3)
+			num_threads == -1 ?
+				histogram_rgb_linear(a, (int)n / 3, image.maxval, local) :
+				histogram_rgb_parallel(a, (int)n / 3, image.maxval, local, num_threads);
+		else
+			num_threads == -1 ?
+				histogram_linear(a, (int)n, image.maxval, local) :
+				histogram_parallel(a, (int)n, image.maxval, local, num_threads);
+		for (int c = 0; c < bins; c++)
+			count[c] = local[c];
+		free(local);
+		return;
+	}
+
+	if (sample_size(image) == 2)
+		rows_histogram<unsigned short>(image, tables, count, num_threads);
+	else
+		rows_histogram<unsigned char>(image, tables, count, num_threads);
+}
+
+void contrast_limits(const image_view& image, bool per_channel, const long long* count, int* min, int* max) {
+	const int tables = contrast_tables(image, per_channel);
+	const long long n = (long long)image.width * image.height * image.channels / tables;
+	for (int t = 0; t < tables; t++)
+		contrast_params(count + t * (image.maxval + 1), n, image.maxval, min[t], max[t]);
+}
+
+// splitmix64: номер блока в группе зависит только от seed и номера группы, а не от числа потоков
+static unsigned long long mix64(unsigned long long x) {
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+// гистограмма выбранных блоков: по одному случайному блоку из каждой группы в group блоков
+template <typename T>
+static long long sampled_histogram(const image_view& image, int tables, long long group, unsigned seed,
+	long long* count, int num_threads) {
+	const int bins = image.maxval + 1;
+	const int size = tables * bins;
+	const bool swap = sizeof(T) == 2 && image.big_endian;
+	const int row_blocks = (image.width + SAMPLE_BLOCK - 1) / SAMPLE_BLOCK;
+	const long long blocks = (long long)row_blocks * image.height;
+	const int groups = (int)((blocks + group - 1) / group);
+	const int team = num_threads == -1 ? 1 : num_threads;
+	int* local = (int*)calloc((size_t)team * size, sizeof(int));
+	long long pixels = 0;
+
+#pragma omp parallel num_threads(team) reduction(+: pixels)
+	{
+		int* h = local + omp_get_thread_num() * size;
+#pragma omp for schedule(static)
+		for (int g = 0; g < groups; g++) {
+			const long long b = g * group + (long long)(mix64(((unsigned long long)seed << 32) + g) % group);
+			if (b >= blocks)
+				continue;
+			const int y = (int)(b / row_blocks);
+			const int x0 = (int)(b % row_blocks) * SAMPLE_BLOCK;
+			const int x1 = x0 + SAMPLE_BLOCK < image.width ? x0 + SAMPLE_BLOCK : image.width;
+			const T* p = (const T*)((const unsigned char*)image.data + y * image.stride);
+			for (int i = x0 * image.channels; i < x1 * image.channels; i++) {
+				const int v = clamp_sample(swap ? be16(p[i]) : p[i], image.maxval);
+				h[(tables == 3 ? i % 3 : 0) * bins + v]++;
+			}
+			pixels += x1 - x0;
+		}
+	}
+	for (int c = 0; c < size; c++) {
+		long long sum = 0;
+		for (int k = 0; k < team; k++)
+			sum += local[k * size + c];
+		count[c] = sum;
+	}
+	free(local);
+	return pixels * image.channels / tables;
+}
+
+void contrast_limits_sampled(const image_view& image, bool per_channel, const histogram_sampling& sampling,
+	int* min, int* max, sampling_report* report, int num_threads) {
+	if (num_threads == 0) num_threads = omp_get_max_threads();
+	const int tables = contrast_tables(image, per_channel);
+	const int bins = image.maxval + 1;
+	const double delta = 1e-3;
+	long long* count = (long long*)malloc(tables * bins * sizeof(long long));
+
+	long long group = sampling.rate > 0 ? (long long)(1 / sampling.rate + 0.5) : 1;
+	if (group < 1) group = 1;
+	long long m = 0;
+	bool exact = group == 1;
+	double epsilon = 0;
+	int cut_error = 0;
+	if (!exact) {
+		m = sample_size(image) == 2 ?
+			sampled_histogram<unsigned short>(image, tables, group, sampling.seed, count, num_threads) :
+			sampled_histogram<unsigned char>(image, tables, group, sampling.seed, count, num_threads);
+		/*
+		 *	Неравенство Бернштейна для доли q = 1 / (colors + 1) с дисперсией q (1 - q), delta делится
+		 *	между 2 * tables порогами. На хвостах оно намного точнее равномерной границы DKW
+		 *	sqrt(ln(2 / delta) / 2m), которая при q = 1/256 сравнима с самим q
+		 */
+		const double q = 1.0 / bins;
+		const double l = log(4.0 * tables / delta);
+		epsilon = m > 0 ? l / (3.0 * m) + sqrt(l * l / (9.0 * m * m) + 2 * q * (1 - q) * l / m) : 1;
+
+		/*
+		 *	contrast_params берёт порог p = n / (colors + 1): границы при порогах (q -+ epsilon) * m
+		 *	получаются подстановкой n. min и max монотонны по порогу, поэтому достаточно сравнить края
+		 */
+		const long long low = q > epsilon ? (long long)((q - epsilon) * m) : 0;
+		const long long high = (long long)((q + epsilon) * m) + 1;
+		// выборка слишком мала: интервал для порога доходит до края гистограммы, а порог high * bins
+		// больше числа отсчётов выборки, и contrast_params вышел бы за гистограмму. Сразу точная,
+		// независимо от tolerance
+		if (m == 0 || low == 0 || high >= m) {
+			cut_error = image.maxval;
+			exact = true;
+		}
+		for (int t = 0; !exact && t < tables; t++) {
+			const long long* h = count + t * bins;
+			int min_low, max_low, min_high, max_high;
+			contrast_params(h, m, image.maxval, min[t], max[t]);
+			contrast_params(h, low * bins, image.maxval, min_low, max_low);
+			contrast_params(h, high * bins, image.maxval, min_high, max_high);
+			const int error = abs(min_high - min_low) > abs(max_low - max_high) ?
+				abs(min_high - min_low) : abs(max_low - max_high);
+			if (error > cut_error)
+				cut_error = error;
+		}
+		if (cut_error > sampling.tolerance * image.maxval)
+			exact = true;
+	}
+	if (exact) {
+		contrast_histogram(image, per_channel, count, num_threads);
+		contrast_limits(image, per_channel, count, min, max);
+	}
+	free(count);
+
+	if (report) {
+		report->samples = m;
+		report->epsilon = epsilon;
+		report->delta = delta;
+		report->cut_error = cut_error;
+		report->exact = exact;
+	}
+}
+
+static void apply_run(const unsigned char* in, unsigned char* out, int n, int tables, const unsigned char* lut,
+	int size, bool /*big_endian*/) {
+	tables == 3 ? lut_apply_rgb(in, out, n / 3, lut, size) : lut_apply(in, out, n, lut);
+}
+
+static void apply_run(const unsigned short* in, unsigned short* out, int n, int tables, const unsigned short* lut,
+	int size, bool big_endian) {
+	if (big_endian)
+		tables == 3 ? lut_apply_rgb_be(in, out, n / 3, lut, size) : lut_apply_be(in, out, n, lut);
+	else
+		tables == 3 ? lut_apply_rgb(in, out, n / 3, lut, size) : lut_apply(in, out, n, lut);
+}
+
+/**
+ *	Строки режутся на куски по APPLY_CHUNK пикселей; непрерывное изображение считается
+ *	одной длинной строкой
+ **/
+template <typename T>
+static void rows_apply(const image_view& in, const image_view& out, int tables, const T* lut, int size,
+	int num_threads) {
+	const bool flat = contiguous(in) && contiguous(out);
+	const long long pixels = flat ? (long long)in.width * in.height : in.width;
+	const int lines = flat ? 1 : in.height;
+	const int pieces = (int)((pixels + APPLY_CHUNK - 1) / APPLY_CHUNK);
+	const int team = num_threads == -1 ? 1 : num_threads;
+
+#pragma omp parallel for num_threads(team) schedule(static)
+	for (int k = 0; k < lines * pieces; k++) {
+		const int y = k / pieces;
+		const long long first = (long long)(k % pieces) * APPLY_CHUNK;
+		const int count = (int)(pixels - first < APPLY_CHUNK ? pixels - first : APPLY_CHUNK);
+		const T* p = (const T*)((const unsigned char*)in.data + y * in.stride) + first * in.channels;
+		T* q = (T*)((unsigned char*)out.data + y * out.stride) + first * out.channels;
+		apply_run(p, q, count * in.channels, tables, lut, size, in.big_endian);
+	}
+}
+
+// таблица на все значения отсчёта: 8-битные SIMD-ядра читают все 256 элементов,
+// а отсчёты больше maxval (испорченные данные) не выходят за таблицу и дают maxval
+static int lut_size(const image_view& image) {
+	return sample_size(image) == 1 ? LUT_SIZE : LUT16_SIZE;
+}
+
+template <typename T>
+static void stretch_apply(const image_view& in, const image_view& out, int tables, const int* min, const int* max,
+	int num_threads) {
+	const int size = lut_size(in);
+	// +1: сборка в lut_apply_be читает по 32 бита
+	T* lut = (T*)malloc((tables * size + 1) * sizeof(T));
+	for (int t = 0; t < tables; t++)
+		build_lut(min[t], max[t], in.maxval, lut + t * size, size);
+	lut[tables * size] = 0;
+	rows_apply(in, out, tables, lut, size, num_threads);
+	free(lut);
+}
+
+bool contrast_apply(const image_view& in, const image_view& out, bool per_channel, const int* min, const int* max,
+	int num_threads) {
+	if (!same_format(in, out))
+		return false;
+	if (num_threads == 0) num_threads = omp_get_max_threads();
+	const int tables = contrast_tables(in, per_channel);
+	if (sample_size(in) == 2)
+		stretch_apply<unsigned short>(in, out, tables, min, max, num_threads);
+	else
+		stretch_apply<unsigned char>(in, out, tables, min, max, num_threads);
+	return true;
+}
+
+bool auto_contrast(const image_view& in, const image_view& out, bool per_channel, int num_threads) {
+	if (!same_format(in, out))
+		return false;
+	if (num_threads == 0) num_threads = omp_get_max_threads();
+	const int tables = contrast_tables(in, per_channel);
+	const long long n = (long long)in.width * in.height * in.channels;
+
+	// непрерывные буферы: оптимизированные гистограммы (подгистограммы, двухуровневая для 16 бит)
+	if (contiguous(in) && contiguous(out) && n <= 0x7FFFFFFF) {
+		const int size = (int)n;
+		if (sample_size(in) == 1)
+			num_threads == -1 ?
+				brightness_linear((const unsigned char*)in.data, (unsigned char*)out.data, size, in.maxval, tables) :
+				brightness_parallel((const unsigned char*)in.data, (unsigned char*)out.data, size, in.maxval, tables,
+					num_threads);
+		else if (in.big_endian)
+			brightness16((const unsigned short*)in.data, (unsigned short*)out.data, size, in.maxval, tables,
+				num_threads);
+		else
+			num_threads == -1 ?
+				brightness_linear((const unsigned short*)in.data, (unsigned short*)out.data, size, in.maxval, tables) :
+				brightness_parallel((const unsigned short*)in.data, (unsigned short*)out.data, size, in.maxval, tables,
+					num_threads);
+		return true;
+	}
+
+	long long* count = (long long*)malloc(tables * (in.maxval + 1) * sizeof(long long));
+	contrast_histogram(in, per_channel, count, num_threads);
+	int min[3], max[3];
+	contrast_limits(in, per_channel, count, min, max);
+	free(count);
+	return contrast_apply(in, out, per_channel, min, max, num_threads);
+}
+
+/**
+ *	Композиция операций в одну таблицу на канал: cur[v] - результат уже пройденных операций
+ *	для входного значения v. Растяжению нужна гистограмма промежуточного изображения,
+ *	она получается из гистограммы входа переносом ячеек через cur, без прохода по пикселям
+ *	@param count Гистограммы входа, нужны только при POINT_STRETCH
+ **/
+template <typename T>
+static void compose_ops(const image_view& in, int tables, const point_op* ops, int op_count, const long long* count,
+	T* lut, int size) {
+	const int colors = in.maxval;
+	const long long n = (long long)in.width * in.height * in.channels / tables;
+	int* cur = (int*)malloc(size * sizeof(int));
+	int* step = (int*)malloc(size * sizeof(int));
+	T* stretch = (T*)malloc(size * sizeof(T));
+	long long* moved = (long long*)malloc((colors + 1) * sizeof(long long));
+
+	for (int t = 0; t < tables; t++) {
+		for (int v = 0; v < size; v++)
+			cur[v] = v > colors ? colors : v;
+		for (int k = 0; k < op_count; k++) {
+			const point_op& op = ops[k];
+			switch (op.type) {
+			case POINT_STRETCH: {
+				for (int c = 0; c <= colors; c++)
+					moved[c] = 0;
+				for (int v = 0; v <= colors; v++)
+					moved[cur[v]] += count[t * (colors + 1) + v];
+				int min, max;
+				contrast_params(moved, n, colors, min, max);
+				build_lut(min, max, colors, stretch, colors + 1);
+				for (int c = 0; c <= colors; c++)
+					step[c] = stretch[c];
+				break;
+			}
+			case POINT_GAMMA:
+				for (int c = 0; c <= colors; c++)
+					step[c] = op.value > 0 ? (int)(colors * pow((double)c / colors, 1 / op.value) + 0.5) : c;
+				break;
+			case POINT_INVERT:
+				for (int c = 0; c <= colors; c++)
+					step[c] = colors - c;
+				break;
+			case POINT_THRESHOLD:
+				for (int c = 0; c <= colors; c++)
+					step[c] = c >= op.value ? colors : 0;
+				break;
+			case POINT_TABLE:
+				for (int c = 0; c <= colors; c++) {
+					const int x = op.table_size > 0 ? op.table[c < op.table_size ? c : op.table_size - 1] : c;
+					step[c] = x < 0 ? 0 : x > colors ? colors : x;
+				}
+				break;
+			}
+			for (int v = 0; v < size; v++)
+				cur[v] = step[cur[v]];
+		}
+		for (int v = 0; v < size; v++)
+			lut[t * size + v] = (T)cur[v];
+	}
+	free(cur);
+	free(step);
+	free(stretch);
+	free(moved);
+}
+
+template <typename T>
+static void pipeline_apply(const image_view& in, const image_view& out, int tables, const point_op* ops,
+	int op_count, const long long* count, int num_threads) {
+	const int size = lut_size(in);
+	T* lut = (T*)malloc((tables * size + 1) * sizeof(T));
+	compose_ops(in, tables, ops, op_count, count, lut, size);
+	lut[tables * size] = 0;
+	rows_apply(in, out, tables, lut, size, num_threads);
+	free(lut);
+}
+
+bool point_pipeline(const image_view& in, const image_view& out, bool per_channel, const point_op* ops,
+	int op_count, int num_threads) {
+	if (!same_format(in, out))
+		return false;
+	if (num_threads == 0) num_threads = omp_get_max_threads();
+	const int tables = contrast_tables(in, per_channel);
+
+	long long* count = NULL;
+	for (int k = 0; k < op_count && !count; k++)
+		if (ops[k].type == POINT_STRETCH) {
+			count = (long long*)malloc(tables * (in.maxval + 1) * sizeof(long long));
+			contrast_histogram(in, per_channel, count, num_threads);
+		}
+	if (sample_size(in) == 2)
+		pipeline_apply<unsigned short>(in, out, tables, ops, op_count, count, num_threads);
+	else
+		pipeline_apply<unsigned char>(in, out, tables, ops, op_count, count, num_threads);
+	free(count);
+	return true;
+}
+
+// разбиение на куски по APPLY_CHUNK пикселей, как в rows_apply: lines строк по pieces кусков
+static void luma_pieces(const image_view& in, const image_view& out, long long& pixels, int& lines, int& pieces) {
+	const bool flat = contiguous(in) && contiguous(out);
+	pixels = flat ? (long long)in.width * in.height : in.width;
+	lines = flat ? 1 : in.height;
+	pieces = (int)((pixels + APPLY_CHUNK - 1) / APPLY_CHUNK);
+}
+
+// яркость 16-битного пикселя по отсчётам, ограниченным colors, как при гистограммах
+static inline int luma16(const unsigned short* p, bool swap, int colors) {
+	const int r = clamp_sample(swap ? be16(p[0]) : p[0], colors), g = clamp_sample(swap ? be16(p[1]) : p[1], colors),
+		b = clamp_sample(swap ? be16(p[2]) : p[2], colors);
+	return (LUMA_R * r + LUMA_G * g + LUMA_B * b + 128) >> 8;
+}
+
+// кусок 8-битных отсчётов, ограниченных colors: при colors < 255 - их копия в buffer, иначе сам кусок
+static const unsigned char* clamped_chunk(const unsigned char* a, int count, int colors, unsigned char* buffer) {
+	if (colors >= 255)
+		return a;
+	for (int i = 0; i < count; i++)
+		buffer[i] = (unsigned char)clamp_sample(a[i], colors);
+	return buffer;
+}
+
+// гистограмма яркости: для 8 бит яркость считается SIMD в буфер из LUMA_CHUNK пикселей
+template <typename T>
+static void luma_histogram(const image_view& in, const image_view& out, long long* count, int team) {
+	const int bins = in.maxval + 1;
+	const bool swap = sizeof(T) == 2 && in.big_endian;
+	long long pixels;
+	int lines, pieces;
+	luma_pieces(in, out, pixels, lines, pieces);
+	int* local = (int*)calloc((size_t)team * bins, sizeof(int));
+
+#pragma omp parallel num_threads(team)
+	{
+		int* h = local + omp_get_thread_num() * bins;
+		unsigned char luma[LUMA_CHUNK], rgb[3 * LUMA_CHUNK];
+#pragma omp for schedule(static)
+		for (int k = 0; k < lines * pieces; k++) {
+			const long long first = (long long)(k % pieces) * APPLY_CHUNK;
+			const int n = (int)(pixels - first < APPLY_CHUNK ? pixels - first : APPLY_CHUNK);
+			const T* p = (const T*)((const unsigned char*)in.data + (k / pieces) * in.stride) + first * 3;
+			if (sizeof(T) == 1)
+				for (int j = 0; j < n; j += LUMA_CHUNK) {
+					const int m = n - j < LUMA_CHUNK ? n - j : LUMA_CHUNK;
+					rgb_luma(clamped_chunk((const unsigned char*)p + 3 * j, 3 * m, in.maxval, rgb), luma, m);
+					for (int i = 0; i < m; i++)
+						h[luma[i]]++;
+				}
+			else
+				for (int i = 0; i < n; i++)
+					h[luma16((const unsigned short*)p + 3 * i, swap, in.maxval)]++;
+		}
+	}
+	for (int c = 0; c < bins; c++) {
+		long long sum = 0;
+		for (int t = 0; t < team; t++)
+			sum += local[t * bins + c];
+		count[c] = sum;
+	}
+	free(local);
+}
+
+/**
+ *	Отсчёт канала c пикселя с яркостью y: c * target[y] / y с округлением,
+ *	не больше maxval; чёрный пиксель (y = 0) становится серым target[0]
+ **/
+template <typename T>
+static void luma_apply(const image_view& in, const image_view& out, const T* target, int team) {
+	const int colors = in.maxval;
+	const bool swap = sizeof(T) == 2 && in.big_endian;
+	long long pixels;
+	int lines, pieces;
+	luma_pieces(in, out, pixels, lines, pieces);
+
+	// 8 бит: таблица 256 x 256 по яркости и отсчёту (64 КБ), 16 бит: коэффициент по яркости
+	unsigned char* table = NULL;
+	double* gain = NULL;
+	if (sizeof(T) == 1) {
+		table = (unsigned char*)malloc(LUT_SIZE * LUT_SIZE);
+		for (int y = 0; y < LUT_SIZE; y++)
+			for (int c = 0; c < LUT_SIZE; c++) {
+				const int v = y ? (2 * c * target[y] + y) / (2 * y) : target[0];
+				table[y * LUT_SIZE + c] = (unsigned char)(v > colors ? colors : v);
+			}
+	}
+	else {
+		gain = (double*)malloc((colors + 1) * sizeof(double));
+		for (int y = 0; y <= colors; y++)
+			gain[y] = y ? (double)target[y] / y : 0;
+	}
+
+#pragma omp parallel num_threads(team)
+	{
+		unsigned char luma[LUMA_CHUNK], rgb[3 * LUMA_CHUNK];
+#pragma omp for schedule(static)
+		for (int k = 0; k < lines * pieces; k++) {
+			const int row = k / pieces;
+			const long long first = (long long)(k % pieces) * APPLY_CHUNK;
+			const int n = (int)(pixels - first < APPLY_CHUNK ? pixels - first : APPLY_CHUNK);
+			const T* p = (const T*)((const unsigned char*)in.data + row * in.stride) + first * 3;
+			T* q = (T*)((unsigned char*)out.data + row * out.stride) + first * 3;
+			if (sizeof(T) == 1)
+				for (int j = 0; j < n; j += LUMA_CHUNK) {
+					const int m = n - j < LUMA_CHUNK ? n - j : LUMA_CHUNK;
+					const unsigned char* a = clamped_chunk((const unsigned char*)p + 3 * j, 3 * m, colors, rgb);
+					unsigned char* b = (unsigned char*)q + 3 * j;
+					rgb_luma(a, luma, m);
+					for (int i = 0; i < m; i++) {
+						const unsigned char* t = table + luma[i] * LUT_SIZE;
+						b[3 * i] = t[a[3 * i]];
+						b[3 * i + 1] = t[a[3 * i + 1]];
+						b[3 * i + 2] = t[a[3 * i + 2]];
+					}
+				}
+			else
+				for (int i = 0; i < 3 * n; i += 3) {
+					const unsigned short* a = (const unsigned short*)p + i;
+					unsigned short* b = (unsigned short*)q + i;
+					const int y = luma16(a, swap, colors);
+					for (int c = 0; c < 3; c++) {
+						const int x = clamp_sample(swap ? be16(a[c]) : a[c], colors);
+						int v = y ? (int)(x * gain[y] + 0.5) : target[0];
+						v = v > colors ? colors : v;
+						b[c] = (unsigned short)(swap ? be16((unsigned short)v) : v);
+					}
+				}
+		}
+	}
+	free(table);
+	free(gain);
+}
+
+template <typename T>
+static void luma_stretch(const image_view& in, const image_view& out, int team) {
+	const int colors = in.maxval;
+	long long* count = (long long*)malloc((colors + 1) * sizeof(long long));
+	luma_histogram<T>(in, out, count, team);
+	int min, max;
+	contrast_params(count, (long long)in.width * in.height, colors, min, max);
+	free(count);
+
+	const int size = lut_size(in);
+	T* target = (T*)malloc(size * sizeof(T));
+	build_lut(min, max, colors, target, size);
+	luma_apply(in, out, target, team);
+	free(target);
+}
+
+bool luma_contrast(const image_view& in, const image_view& out, int num_threads) {
+	if (!same_format(in, out))
+		return false;
+	if (in.channels != 3)
+		return auto_contrast(in, out, false, num_threads);
+	if (num_threads == 0) num_threads = omp_get_max_threads();
+	const int team = num_threads == -1 ? 1 : num_threads;
+	if (sample_size(in) == 2)
+		luma_stretch<unsigned short>(in, out, team);
+	else
+		luma_stretch<unsigned char>(in, out, team);
+	return true;
+}
+
+/**
+ *	Таблица эквализации тайла: ячейки выше предела срезаются, излишек поровну
+ *	(остаток - по одному в первые ячейки) раздаётся всем, таблица - накопленная сумма,
+ *	отнесённая к числу отсчётов
+ **/
+static void tile_lut(int* h, int bins, int samples, double clip, int colors, float* lut) {
+	if (clip > 0) {
+		int limit = (int)(clip * samples / bins);
+		if (limit < 1) limit = 1;
+		long long excess = 0;
+		for (int b = 0; b < bins; b++)
+			if (h[b] > limit) {
+				excess += h[b] - limit;
+				h[b] = limit;
+			}
+		const int step = (int)(excess / bins);
+		const int rest = (int)(excess % bins);
+		for (int b = 0; b < bins; b++)
+			h[b] += step + (b < rest);
+	}
+	const float scale = samples ? (float)colors / samples : 0;
+	long long sum = 0;
+	for (int b = 0; b < bins; b++) {
+		sum += h[b];
+		lut[b] = sum * scale;
+	}
+}
+
+// границы тайлов: first[j] - первый пиксель тайла j, first[tiles] = size
+static void tile_bounds(int size, int tiles, int* first) {
+	for (int j = 0; j <= tiles; j++)
+		first[j] = (int)((long long)j * size / tiles);
+}
+
+/**
+ *	Соседние центры тайлов для координаты x: левый тайл и вес правого. До первого
+ *	и после последнего центра берётся крайний тайл с весом 0
+ **/
+static int tile_neighbour(int x, const int* first, int tiles, float& weight) {
+	int j = 0;
+	while (j + 1 < tiles && x >= (first[j + 1] + first[j + 2] - 1) * 0.5f)
+		j++;
+	const float center = (first[j] + first[j + 1] - 1) * 0.5f;
+	if (j + 1 == tiles || x < center) {
+		weight = 0;
+		return j;
+	}
+	weight = (x - center) / ((first[j + 1] + first[j + 2] - 1) * 0.5f - center);
+	return j;
+}
+
+template <typename T>
+static void tiles_contrast(const image_view& in, const image_view& out, int tables, int tiles_x, int tiles_y,
+	double clip, int num_threads) {
+	int shift = 0;
+	while ((in.maxval >> shift) >= COARSE_BINS)
+		shift++;
+	const int bins = (in.maxval >> shift) + 1;
+	const int table_size = tables * bins;
+	const int row = in.width * in.channels;
+	const bool swap = sizeof(T) == 2 && in.big_endian;
+	const int team = num_threads == -1 ? 1 : num_threads;
+
+	int* first_x = (int*)malloc((tiles_x + 1) * sizeof(int));
+	int* first_y = (int*)malloc((tiles_y + 1) * sizeof(int));
+	tile_bounds(in.width, tiles_x, first_x);
+	tile_bounds(in.height, tiles_y, first_y);
+	float* luts = (float*)malloc((size_t)tiles_x * tiles_y * table_size * sizeof(float));
+
+	// тайлы целиком помещаются в кэш: каждый поток строит гистограммы своих тайлов
+#pragma omp parallel num_threads(team)
+	{
+		int* h = (int*)malloc(table_size * sizeof(int));
+#pragma omp for schedule(dynamic, 1)
+		for (int t = 0; t < tiles_x * tiles_y; t++) {
+			const int tx = t % tiles_x, ty = t / tiles_x;
+			const int x0 = first_x[tx] * in.channels, x1 = first_x[tx + 1] * in.channels;
+			memset(h, 0, table_size * sizeof(int));
+			for (int y = first_y[ty]; y < first_y[ty + 1]; y++) {
+				const T* p = (const T*)((const unsigned char*)in.data + y * in.stride);
+				if (tables == 3)
+					for (int i = x0; i < x1; i += 3) {
+						h[clamp_sample(swap ? be16(p[i]) : p[i], in.maxval) >> shift]++;
+						h[bins + (clamp_sample(swap ? be16(p[i + 1]) : p[i + 1], in.maxval) >> shift)]++;
+						h[2 * bins + (clamp_sample(swap ? be16(p[i + 2]) : p[i + 2], in.maxval) >> shift)]++;
+					}
+				else
+					for (int i = x0; i < x1; i++)
+						h[clamp_sample(swap ? be16(p[i]) : p[i], in.maxval) >> shift]++;
+			}
+			const int samples = (x1 - x0) * (first_y[ty + 1] - first_y[ty]) / tables;
+			for (int k = 0; k < tables; k++)
+				tile_lut(h + k * bins, bins, samples, clip, in.maxval, luts + (size_t)t * table_size + k * bins);
+		}
+		free(h);
+	}
+
+	// по столбцам: левый тайл, вес правого и смещение таблицы канала для каждого отсчёта
+	int* left = (int*)malloc(in.width * sizeof(int));
+	float* wx = (float*)malloc(row * sizeof(float));
+	int* base = (int*)malloc(row * sizeof(int));
+	for (int x = 0; x < in.width; x++) {
+		float w;
+		left[x] = tile_neighbour(x, first_x, tiles_x, w);
+		for (int c = 0; c < in.channels; c++) {
+			wx[x * in.channels + c] = w;
+			base[x * in.channels + c] = tables == 3 ? c * bins : 0;
+		}
+	}
+
+#pragma omp parallel num_threads(team)
+	{
+		float* rows = sizeof(T) == 1 ? (float*)malloc((size_t)tiles_x * table_size * sizeof(float)) : NULL;
+#pragma omp for schedule(static)
+		for (int y = 0; y < in.height; y++) {
+			float wy;
+			const int top = tile_neighbour(y, first_y, tiles_y, wy);
+			const int bottom = top + 1 < tiles_y ? top + 1 : top;
+			const float* upper = luts + (size_t)top * tiles_x * table_size;
+			const float* lower = luts + (size_t)bottom * tiles_x * table_size;
+			if (rows)
+				for (int c = 0; c < tiles_x * table_size; c++)
+					rows[c] = upper[c] + (lower[c] - upper[c]) * wy;
+
+			const T* p = (const T*)((const unsigned char*)in.data + y * in.stride);
+			T* q = (T*)((unsigned char*)out.data + y * out.stride);
+			// отрезки строки с одной и той же четвёркой тайлов
+			for (int x = 0; x < in.width;) {
+				int end = x + 1;
+				while (end < in.width && left[end] == left[x])
+					end++;
+				const int l = left[x], r = l + 1 < tiles_x ? l + 1 : l;
+				const float* luts4[4] = {
+					upper + (size_t)l * table_size, upper + (size_t)r * table_size,
+					lower + (size_t)l * table_size, lower + (size_t)r * table_size
+				};
+				const int i = x * in.channels;
+				/*
+				 *	Для 8 бит таблицы верхнего и нижнего ряда заранее смешаны по вертикали на всю строку (rows),
+				 *	остаётся интерполяция по x; у 16-битных таблиц до 4096 ячеек, смешивать их на каждую
+				 *	строку дороже, чем интерполировать все четыре таблицы в каждом отсчёте
+				 */
+				if (sizeof(T) == 1)
+					lut_lerp((const unsigned char*)(p + i), (unsigned char*)(q + i), (end - x) * in.channels,
+						rows + (size_t)l * table_size, rows + (size_t)r * table_size, base + i, wx + i, in.maxval);
+				else
+					lut_bilinear((const unsigned short*)(p + i), (unsigned short*)(q + i), (end - x) * in.channels,
+						luts4, base + i, wx + i, wy, shift, in.big_endian, in.maxval);
+				x = end;
+			}
+		}
+		free(rows);
+	}
+
+	free(left);
+	free(wx);
+	free(base);
+	free(luts);
+	free(first_x);
+	free(first_y);
+}
+
+bool local_contrast(const image_view& in, const image_view& out, bool per_channel, const tile_grid& grid,
+	int num_threads) {
+	if (!same_format(in, out) || grid.tiles_x < 1 || grid.tiles_y < 1)
+		return false;
+	if (num_threads == 0) num_threads = omp_get_max_threads();
+	const int tables = contrast_tables(in, per_channel);
+	const int tiles_x = grid.tiles_x < in.width ? grid.tiles_x : in.width;
+	const int tiles_y = grid.tiles_y < in.height ? grid.tiles_y : in.height;
+	if (sample_size(in) == 2)
+		tiles_contrast<unsigned short>(in, out, tables, tiles_x, tiles_y, grid.clip, num_threads);
+	else
+		tiles_contrast<unsigned char>(in, out, tables, tiles_x, tiles_y, grid.clip, num_threads);
+	return true;
+}
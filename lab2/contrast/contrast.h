@@ -0,0 +1,138 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ *	Изображение в памяти вызывающего: height строк через stride байт,
+ *	в строке width пикселей по channels отсчётов. Библиотека ничего не копирует
+ *	и не работает с файлами
+ **/
+struct image_view {
+	void* data;
+	int width;
+	int height;
+	size_t stride;
+	// 1 (оттенки серого) или 3 (RGB)
+	int channels;
+	// максимальное значение отсчёта: до 255 - байт на отсчёт, иначе два байта. Отсчёты больше maxval
+	// (испорченные данные) считаются равными maxval и не выводят за гистограммы и таблицы
+	int maxval;
+	// 16-битные отсчёты старшим байтом вперёд, как в файлах Netpbm; иначе в порядке процессора
+	bool big_endian;
+};
+
+// количество таблиц: 3, если параметры считаются по каналам RGB, иначе 1
+int contrast_tables(const image_view& image, bool per_channel);
+
+/**
+ *	Точная гистограмма изображения
+ *	@param count contrast_tables гистограмм по maxval + 1 ячеек
+ *	@param num_threads Количество потоков, -1 - последовательная версия, 0 - по умолчанию OpenMP
+ **/
+void contrast_histogram(const image_view& image, bool per_channel, long long* count, int num_threads);
+
+/**
+ *	Границы растяжения по гистограмме: отбрасывается по 1 / (maxval + 1) самых тёмных
+ *	и самых светлых отсчётов, min и max - крайние цвета между порогами
+ *	@param min, max По contrast_tables элементов
+ **/
+void contrast_limits(const image_view& image, bool per_channel, const long long* count, int* min, int* max);
+
+/**
+ *	Растягивает [min, max] в [0, maxval]. out того же размера и формата, что in,
+ *	может совпадать с ним
+ *	@return false, если форматы in и out не совпадают
+ **/
+bool contrast_apply(const image_view& in, const image_view& out, bool per_channel, const int* min, const int* max,
+	int num_threads);
+
+// гистограмма, границы и применение за один вызов; для непрерывных изображений - самым быстрым путём
+bool auto_contrast(const image_view& in, const image_view& out, bool per_channel, int num_threads);
+
+/**
+ *	Выборка для гистограммы: доля пикселей rate, seed задаёт выбор блоков,
+ *	tolerance - допустимая неопределённость границ в долях maxval
+ **/
+struct histogram_sampling {
+	double rate;
+	unsigned seed;
+	double tolerance;
+};
+
+struct sampling_report {
+	// отсчётов в выборке на одну таблицу
+	long long samples;
+	// ошибка долей на порогах не больше epsilon с вероятностью 1 - delta
+	double epsilon;
+	double delta;
+	// ширина интервала, в котором с той же вероятностью лежат min и max, в значениях отсчётов
+	int cut_error;
+	// интервал шире допустимого, и границы посчитаны по точной гистограмме
+	bool exact;
+};
+
+/**
+ *	Границы растяжения по выборке. Изображение делится на блоки по 1024 пикселя строки,
+ *	из каждой группы в 1 / rate блоков выбирается один случайный (детерминированно по seed),
+ *	так что читается примерно rate памяти. Доля отсчётов ниже порога по выборке отличается
+ *	от точной не больше чем на epsilon с вероятностью 1 - delta (неравенство Бернштейна
+ *	для доли 1 / (maxval + 1); для независимых отсчётов, а внутри блока они зависимы, поэтому
+ *	это оценка). Границы при порогах, сдвинутых на +-epsilon, дают интервалы для min и max;
+ *	если они шире tolerance * maxval, строится точная гистограмма
+ *	@param report Может быть NULL
+ **/
+void contrast_limits_sampled(const image_view& image, bool per_channel, const histogram_sampling& sampling,
+	int* min, int* max, sampling_report* report, int num_threads);
+
+/**
+ *	Растяжение по яркости Y = (77 R + 150 G + 29 B + 128) >> 8: границы считаются по гистограмме
+ *	яркости, все три отсчёта пикселя умножаются на один коэффициент Y' / Y, поэтому оттенок
+ *	не меняется (в YCbCr это растяжение Y с тем же масштабом Cb, Cr); отсчёты больше maxval
+ *	ограничиваются. Два прохода по памяти; для изображений в оттенках серого - auto_contrast
+ *	@return false, если форматы in и out не совпадают
+ **/
+bool luma_contrast(const image_view& in, const image_view& out, int num_threads);
+
+enum point_op_type {
+	// растяжение по гистограмме изображения после предыдущих операций, как в auto_contrast
+	POINT_STRETCH,
+	// maxval * (v / maxval) ^ (1 / value): value > 1 осветляет
+	POINT_GAMMA,
+	// maxval - v
+	POINT_INVERT,
+	// maxval, если v >= value, иначе 0
+	POINT_THRESHOLD,
+	// table[v]; значения за концом таблицы берутся из последнего элемента, результат ограничен [0, maxval]
+	POINT_TABLE
+};
+
+struct point_op {
+	point_op_type type;
+	double value;
+	const int* table;
+	int table_size;
+};
+
+/**
+ *	Цепочка поточечных операций по порядку. Операции сводятся в одну таблицу на канал,
+ *	которая применяется за один проход; гистограмма строится, только если есть растяжение
+ *	@return false, если форматы in и out не совпадают
+ **/
+bool point_pipeline(const image_view& in, const image_view& out, bool per_channel, const point_op* ops,
+	int op_count, int num_threads);
+
+// сетка локального контраста: tiles_x * tiles_y тайлов, clip - предел ячейки гистограммы тайла в средних
+struct tile_grid {
+	int tiles_x;
+	int tiles_y;
+	double clip;
+};
+
+/**
+ *	Локальный контраст (CLAHE): у каждого тайла своя эквализация гистограммы с ограничением
+ *	ячеек (излишек распределяется по всем ячейкам, clip <= 0 - без ограничения), значение
+ *	пикселя интерполируется билинейно между таблицами четырёх ближайших центров тайлов.
+ *	16-битные гистограммы тайлов строятся по старшим битам (не больше 4096 ячеек)
+ *	@return false, если форматы in и out не совпадают
+ **/
+bool local_contrast(const image_view& in, const image_view& out, bool per_channel, const tile_grid& grid,
+	int num_threads);
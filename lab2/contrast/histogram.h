@@ -0,0 +1,312 @@
+#pragma once
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lut.h"
+
+// Внутренние функции библиотеки: гистограммы, параметры и применение таблиц над непрерывными
+// массивами отсчётов. Для встраивания предназначен contrast.h, этот заголовок нужен
+// программе lab2 для потокового режима и сравнения гистограмм
+
+#define LANES 4
+#define CACHE_LINE_INTS 16
+#define LUT_SIZE 256
+#define LUT16_SIZE 65536
+#define APPLY_CHUNK 65536
+#define COARSE_BINS 4096
+#define FINE_BUCKETS 6
+#define LUMA_CHUNK 4096
+#define SAMPLE_BLOCK 1024
+
+// отсчёт больше colors бывает только в испорченном файле и считается равным colors, как sample() в contrast.cl
+inline int clamp_sample(int v, int colors) {
+	return v > colors ? colors : v;
+}
+
+/**
+ *	@param a Массив цветов пикселей
+ *	@param n Количество пикселей
+ *	@param colors Максимальное значение цвета
+ *	@param count Гистограмма из colors + 1 ячеек
+ **/
+template <typename T>
+void histogram_linear(const T* a, int n, int colors, int* count) {
+	for (int i = 0; i <= colors; i++)
+		count[i] = 0;
+
+	for (int i = 0; i < n; i++)
+		count[clamp_sample(a[i], colors)]++;
+}
+
+// общая гистограмма на все потоки, как было раньше (atomic вместо гонки), - для сравнения
+template <typename T>
+void histogram_shared(const T* a, int n, int colors, int* count, int num_threads) {
+	for (int i = 0; i <= colors; i++)
+		count[i] = 0;
+
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+	for (int i = 0; i < n; i++) {
+#pragma omp atomic
+		count[clamp_sample(a[i], colors)]++;
+	}
+}
+
+/**
+ *	Гистограмма по приватным подгистограммам: у каждого потока LANES копий,
+ *	соседние пиксели попадают в разные копии, поэтому серия одинаковых значений
+ *	не ждёт предыдущего инкремента той же ячейки. Копии выровнены на линию кэша,
+ *	слияние идёт параллельно по цветам. Копии 8-битной гистограммы покрывают все 256 значений,
+ *	поэтому в горячем цикле отсчёт не сравнивается с colors: ячейки за colors прибавляются к colors
+ *	после слияния
+ **/
+template <typename T>
+void histogram_parallel(const T* a, int n, int colors, int* count, int num_threads) {
+	const int range = sizeof(T) == 1 ? LUT_SIZE : colors + 1;
+	const int stride = (range + CACHE_LINE_INTS - 1) / CACHE_LINE_INTS * CACHE_LINE_INTS;
+	const int copies = num_threads * LANES;
+	int* local = (int*)calloc((size_t)copies * stride, sizeof(int));
+	const int quads = n / LANES;
+
+#pragma omp parallel num_threads(num_threads)
+	{
+		int* h = local + omp_get_thread_num() * LANES * stride;
+
+#pragma omp for schedule(static)
+		for (int q = 0; q < quads; q++) {
+			const T* p = a + q * LANES;
+			h[sizeof(T) == 1 ? p[0] : clamp_sample(p[0], colors)]++;
+			h[stride + (sizeof(T) == 1 ? p[1] : clamp_sample(p[1], colors))]++;
+			h[2 * stride + (sizeof(T) == 1 ? p[2] : clamp_sample(p[2], colors))]++;
+			h[3 * stride + (sizeof(T) == 1 ? p[3] : clamp_sample(p[3], colors))]++;
+		}
+#pragma omp master
+		for (int i = quads * LANES; i < n; i++)
+			h[sizeof(T) == 1 ? a[i] : clamp_sample(a[i], colors)]++;
+#pragma omp barrier
+
+#pragma omp for schedule(static)
+		for (int c = 0; c <= colors; c++) {
+			int sum = 0;
+			for (int k = 0; k < copies; k++)
+				sum += local[k * stride + c];
+			count[c] = sum;
+		}
+	}
+	for (int k = 0; k < copies; k++)
+		for (int c = colors + 1; c < range; c++)
+			count[colors] += local[k * stride + c];
+	free(local);
+}
+
+/**
+ *	Гистограммы каналов за один проход по тройкам R, G, B: три гистограммы
+ *	сами играют роль независимых копий, как LANES в histogram_parallel
+ *	@param n Количество пикселей
+ *	@param count Гистограммы каналов подряд, по colors + 1 ячеек
+ **/
+template <typename T>
+void histogram_rgb_linear(const T* a, int n, int colors, int* count) {
+	const int bins = colors + 1;
+	for (int i = 0; i < 3 * bins; i++)
+		count[i] = 0;
+
+	for (int i = 0; i < n; i++) {
+		count[clamp_sample(a[3 * i], colors)]++;
+		count[bins + clamp_sample(a[3 * i + 1], colors)]++;
+		count[2 * bins + clamp_sample(a[3 * i + 2], colors)]++;
+	}
+}
+
+// копии 8-битных каналов, как в histogram_parallel, покрывают все 256 значений
+template <typename T>
+void histogram_rgb_parallel(const T* a, int n, int colors, int* count, int num_threads) {
+	const int bins = colors + 1;
+	const int range = sizeof(T) == 1 ? LUT_SIZE : bins;
+	const int stride = (range + CACHE_LINE_INTS - 1) / CACHE_LINE_INTS * CACHE_LINE_INTS;
+	int* local = (int*)calloc((size_t)num_threads * 3 * stride, sizeof(int));
+
+#pragma omp parallel num_threads(num_threads)
+	{
+		int* h = local + omp_get_thread_num() * 3 * stride;
+
+#pragma omp for schedule(static)
+		for (int i = 0; i < n; i++) {
+			const T* p = a + 3 * i;
+			h[sizeof(T) == 1 ? p[0] : clamp_sample(p[0], colors)]++;
+			h[stride + (sizeof(T) == 1 ? p[1] : clamp_sample(p[1], colors))]++;
+			h[2 * stride + (sizeof(T) == 1 ? p[2] : clamp_sample(p[2], colors))]++;
+		}
+
+#pragma omp for schedule(static)
+		for (int c = 0; c < 3 * bins; c++) {
+			const int channel = c / bins, v = c % bins;
+			int sum = 0;
+			for (int t = 0; t < num_threads; t++)
+				sum += local[(t * 3 + channel) * stride + v];
+			count[c] = sum;
+		}
+	}
+	for (int k = 0; k < num_threads * 3; k++)
+		for (int v = bins; v < range; v++)
+			count[(k % 3) * bins + colors] += local[k * stride + v];
+	free(local);
+}
+
+/**
+ *	Параметры растяжения по гистограмме: отбрасывается по n / (colors + 1)
+ *	самых тёмных и самых светлых пикселей, min и max - крайние встречающиеся
+ *	цвета строго между порогами. Если таких нет, min > max.
+ *	Гистограмма может быть сглаженной (дробной): пустой считается ячейка меньше половины отсчёта
+ *	@param count Гистограмма из colors + 1 ячеек
+ *	@param n Количество пикселей
+ **/
+template <typename C>
+void contrast_params(const C* count, long long n, int colors, int& min, int& max) {
+	typedef decltype(count[0] + 0LL) sum_t;
+	const long long p = n / (colors + 1);
+
+	sum_t start = 0;
+	int k = 0;
+	while (start < p)
+		start += count[k++];
+	int startClr = k;
+	sum_t end = 0;
+	k = colors;
+	while (end < p)
+		end += count[k--];
+	int endClr = k;
+
+	// init min max
+	max = startClr;
+	min = endClr;
+
+	// find min max
+	for (int c = startClr + 1; c < endClr; c++)
+		if (count[c] > 0.5) {
+			min = c;
+			break;
+		}
+	for (int c = endClr - 1; c > startClr; c--)
+		if (count[c] > 0.5) {
+			max = c;
+			break;
+		}
+}
+
+/**
+ *	Таблица нового значения для каждого цвета: (X - min) * colors / (max - min),
+ *	ограниченное [0, colors]. Если max <= min, растягивать нечего и таблица тождественная.
+ *	Для 8 бит считается во float, как раньше, для 16 бит - в double без переполнения.
+ *	Элементы за colors (для отсчётов испорченного файла) равны colors
+ *	@param size Размер таблицы, не меньше colors + 1
+ **/
+template <typename T>
+void build_lut(int min, int max, int colors, T* lut, int size) {
+	const int mn = max - min;
+	for (int v = 0; v < size; v++) {
+		if (v > colors) {
+			lut[v] = (T)colors;
+			continue;
+		}
+		if (mn <= 0) {
+			lut[v] = v;
+			continue;
+		}
+		const long long t = sizeof(T) == 1 ?
+			(long long)((v - min) * colors / (float)mn) : (long long)((double)(v - min) * colors / mn);
+		lut[v] = t > colors ? colors : (T)llabs(t);
+	}
+}
+
+// применение таблицы на месте кусками по APPLY_CHUNK отсчётов, внутри куска - SIMD (lut_apply)
+template <typename T>
+void apply_lut(const T* in, T* out, int n, const T* lut, int num_threads) {
+	const int chunks = (n + APPLY_CHUNK - 1) / APPLY_CHUNK;
+
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+	for (int c = 0; c < chunks; c++) {
+		const int begin = c * APPLY_CHUNK;
+		const int count = n - begin < APPLY_CHUNK ? n - begin : APPLY_CHUNK;
+		lut_apply(in + begin, out + begin, count, lut);
+	}
+}
+
+/**
+ *	Строит tables таблиц по lut_size элементов по гистограммам из colors + 1 ячеек
+ *	@param n Количество отсчётов в каждой гистограмме
+ **/
+template <typename T, typename C>
+void contrast_lut(const C* count, long long n, int colors, int tables, T* lut, int lut_size) {
+	for (int t = 0; t < tables; t++) {
+		int min, max;
+		contrast_params(count + t * (colors + 1), n, colors, min, max);
+		build_lut(min, max, colors, lut + t * lut_size, lut_size);
+	}
+}
+
+template <typename T>
+void apply_lut_rgb(const T* in, T* out, int n, const T* lut, int lut_size, int num_threads) {
+	const int chunks = (n + APPLY_CHUNK - 1) / APPLY_CHUNK;
+
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+	for (int c = 0; c < chunks; c++) {
+		const int begin = c * APPLY_CHUNK;
+		const int count = n - begin < APPLY_CHUNK ? n - begin : APPLY_CHUNK;
+		lut_apply_rgb(in + 3 * begin, out + 3 * begin, count, lut, lut_size);
+	}
+}
+
+/**
+ *	@param a Массив цветов пикселей
+ *	@param out Результат, может совпадать с a
+ *	@param n Количество отсчётов
+ *	@param colors количество цветов
+ *	@param tables 1 - общие параметры для всех отсчётов, 3 - свои для каждого канала RGB
+ **/
+template <typename T>
+void brightness_linear(const T* a, T* out, int n, int colors, int tables) {
+	int* count = (int*)malloc(tables * (colors + 1) * sizeof(int));
+	tables == 3 ? histogram_rgb_linear(a, n / 3, colors, count) : histogram_linear(a, n, colors, count);
+
+	const int size = sizeof(T) == 1 ? LUT_SIZE : LUT16_SIZE;
+	T* lut = (T*)malloc(tables * size * sizeof(T));
+	contrast_lut(count, n / tables, colors, tables, lut, size);
+	free(count);
+
+	tables == 3 ? lut_apply_rgb(a, out, n / 3, lut, size) : lut_apply(a, out, n, lut);
+	free(lut);
+}
+
+template <typename T>
+void brightness_parallel(const T* a, T* out, int n, int colors, int tables, int num_threads) {
+	int* count = (int*)malloc(tables * (colors + 1) * sizeof(int));
+	tables == 3 ?
+		histogram_rgb_parallel(a, n / 3, colors, count, num_threads) :
+		histogram_parallel(a, n, colors, count, num_threads);
+
+	const int size = sizeof(T) == 1 ? LUT_SIZE : LUT16_SIZE;
+	T* lut = (T*)malloc(tables * size * sizeof(T));
+	contrast_lut(count, n / tables, colors, tables, lut, size);
+	free(count);
+
+	tables == 3 ?
+		apply_lut_rgb(a, out, n / 3, lut, size, num_threads) :
+		apply_lut(a, out, n, lut, num_threads);
+	free(lut);
+}
+
+// 16-битные отсчёты Netpbm хранятся старшим байтом вперёд, out может совпадать с in
+void swap_bytes(const unsigned short* in, unsigned short* out, int n, int num_threads);
+
+// 8-битным отсчётам порядок байт не важен
+void swap_bytes(const unsigned char* in, unsigned char* out, int n, int num_threads);
+
+/**
+ *	Двухуровневая гистограмма 16-битных отсчётов в порядке файла (старший байт вперёд)
+ *	@param tables 1 - одна гистограмма на все отсчёты, 3 - по каналам RGB
+ *	@param count tables гистограмм по colors + 1 ячеек, годится только для contrast_params
+ **/
+void histogram16(const unsigned short* a, int n, int colors, int tables, int* count, int num_threads);
+
+// 16-битная обработка прямо по отсчётам в порядке файла
+void brightness16(const unsigned short* a, unsigned short* out, int n, int colors, int tables, int num_threads);
@@ -0,0 +1,532 @@
+#include "lut.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define LUT_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET(x)
+#else
+#define TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+simd_level detect_simd() {
+	// результат записывается один раз, чтобы параллельные вызовы не видели промежуточных значений
+	static int cached = -1;
+	if (cached >= 0)
+		return (simd_level)cached;
+	int level = SIMD_SCALAR;
+#ifdef LUT_X86
+#ifdef _MSC_VER
+	int r[4];
+	__cpuid(r, 0);
+	const int max_leaf = r[0];
+	__cpuid(r, 1);
+	const bool ssse3 = (r[2] & (1 << 9)) != 0;
+	const bool osxsave = (r[2] & (1 << 27)) != 0;
+	const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool avx2 = false, vbmi = false;
+	if (max_leaf >= 7) {
+		__cpuidex(r, 7, 0);
+		avx2 = (r[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6;
+		vbmi = (r[1] & (1 << 16)) && (r[1] & (1 << 30)) && (r[2] & (1 << 1)) && (xcr0 & 0xE6) == 0xE6;
+	}
+#else
+	__builtin_cpu_init();
+	const bool ssse3 = __builtin_cpu_supports("ssse3");
+	const bool avx2 = __builtin_cpu_supports("avx2");
+	const bool vbmi = __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi");
+#endif
+	if (vbmi)
+		level = SIMD_AVX512VBMI;
+	else if (avx2)
+		level = SIMD_AVX2;
+	else if (ssse3)
+		level = SIMD_SSSE3;
+#endif
+	cached = level;
+	return (simd_level)level;
+}
+
+const char* simd_name(simd_level level) {
+	const char* names[] = { "scalar", "ssse3", "avx2", "avx512vbmi" };
+	return names[level];
+}
+
+static void lut_scalar(const unsigned char* in, unsigned char* out, int n, const unsigned char* lut) {
+	for (int i = 0; i < n; i++)
+		out[i] = lut[in[i]];
+}
+
+#ifdef LUT_X86
+// 16 таблиц по 16 элементов: pshufb по младшим 4 битам, выбор таблицы по старшим
+TARGET("ssse3")
+static void lut_ssse3(const unsigned char* in, unsigned char* out, int n, const unsigned char* lut) {
+	__m128i t[16];
+	for (int k = 0; k < 16; k++)
+		t[k] = _mm_loadu_si128((const __m128i*)(lut + 16 * k));
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+		const __m128i lo = _mm_and_si128(x, nibble);
+		const __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), nibble);
+		__m128i r = _mm_setzero_si128();
+		for (int k = 0; k < 16; k++) {
+			const __m128i m = _mm_cmpeq_epi8(hi, _mm_set1_epi8((char)k));
+			r = _mm_or_si128(r, _mm_and_si128(m, _mm_shuffle_epi8(t[k], lo)));
+		}
+		_mm_storeu_si128((__m128i*)(out + i), r);
+	}
+	lut_scalar(in + i, out + i, n - i, lut);
+}
+
+TARGET("avx2")
+static void lut_avx2(const unsigned char* in, unsigned char* out, int n, const unsigned char* lut) {
+	__m256i t[16];
+	for (int k = 0; k < 16; k++)
+		t[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(lut + 16 * k)));
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+	int i = 0;
+	for (; i + 32 <= n; i += 32) {
+		const __m256i x = _mm256_loadu_si256((const __m256i*)(in + i));
+		const __m256i lo = _mm256_and_si256(x, nibble);
+		const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+		__m256i r = _mm256_setzero_si256();
+		for (int k = 0; k < 16; k++) {
+			const __m256i m = _mm256_cmpeq_epi8(hi, _mm256_set1_epi8((char)k));
+			r = _mm256_or_si256(r, _mm256_and_si256(m, _mm256_shuffle_epi8(t[k], lo)));
+		}
+		_mm256_storeu_si256((__m256i*)(out + i), r);
+	}
+	lut_scalar(in + i, out + i, n - i, lut);
+}
+
+// 4 таблицы по 64 элемента: vpermi2b по младшим 7 битам, старший бит выбирает пару таблиц
+TARGET("avx512f,avx512bw,avx512vbmi")
+static void lut_avx512vbmi(const unsigned char* in, unsigned char* out, int n, const unsigned char* lut) {
+	const __m512i t0 = _mm512_loadu_si512(lut);
+	const __m512i t1 = _mm512_loadu_si512(lut + 64);
+	const __m512i t2 = _mm512_loadu_si512(lut + 128);
+	const __m512i t3 = _mm512_loadu_si512(lut + 192);
+
+	int i = 0;
+	for (; i + 64 <= n; i += 64) {
+		const __m512i x = _mm512_loadu_si512(in + i);
+		const __m512i lo = _mm512_permutex2var_epi8(t0, x, t1);
+		const __m512i hi = _mm512_permutex2var_epi8(t2, x, t3);
+		_mm512_storeu_si512(out + i, _mm512_mask_blend_epi8(_mm512_movepi8_mask(x), lo, hi));
+	}
+	lut_scalar(in + i, out + i, n - i, lut);
+}
+
+// то же для трёх таблиц: каждый отсчёт ищется во всех трёх, нужная выбирается маской канала
+TARGET("avx512f,avx512bw,avx512vbmi")
+static void lut_rgb_avx512vbmi(const unsigned char* in, unsigned char* out, int n, const unsigned char* lut) {
+	__m512i t[3][4];
+	for (int c = 0; c < 3; c++)
+		for (int k = 0; k < 4; k++)
+			t[c][k] = _mm512_loadu_si512(lut + 256 * c + 64 * k);
+	// канал байта j вектора, начинающегося с отсчёта i, равен (i % 3 + j) % 3
+	__mmask64 green[3], blue[3];
+	for (int phase = 0; phase < 3; phase++) {
+		unsigned long long g = 0, b = 0;
+		for (int j = 0; j < 64; j++) {
+			if ((phase + j) % 3 == 1)
+				g |= 1ULL << j;
+			else if ((phase + j) % 3 == 2)
+				b |= 1ULL << j;
+		}
+		green[phase] = g;
+		blue[phase] = b;
+	}
+
+	const int samples = n * 3;
+	int i = 0;
+	for (; i + 64 <= samples; i += 64) {
+		const int phase = i % 3;
+		const __m512i x = _mm512_loadu_si512(in + i);
+		const __mmask64 high = _mm512_movepi8_mask(x);
+		__m512i r[3];
+		for (int c = 0; c < 3; c++)
+			r[c] = _mm512_mask_blend_epi8(high, _mm512_permutex2var_epi8(t[c][0], x, t[c][1]),
+				_mm512_permutex2var_epi8(t[c][2], x, t[c][3]));
+		__m512i v = _mm512_mask_blend_epi8(green[phase], r[0], r[1]);
+		v = _mm512_mask_blend_epi8(blue[phase], v, r[2]);
+		_mm512_storeu_si512(out + i, v);
+	}
+	for (; i < samples; i++)
+		out[i] = lut[256 * (i % 3) + in[i]];
+}
+#endif
+
+void lut_apply(const unsigned char* in, unsigned char* out, int n, const unsigned char* lut) {
+#ifdef LUT_X86
+	switch (detect_simd()) {
+	case SIMD_AVX512VBMI:
+		lut_avx512vbmi(in, out, n, lut);
+		return;
+	case SIMD_AVX2:
+		lut_avx2(in, out, n, lut);
+		return;
+	case SIMD_SSSE3:
+		lut_ssse3(in, out, n, lut);
+		return;
+	default:
+		break;
+	}
+#endif
+	lut_scalar(in, out, n, lut);
+}
+
+void lut_apply(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut) {
+	for (int i = 0; i < n; i++)
+		out[i] = lut[in[i]];
+}
+
+template <typename T>
+static void lut_rgb_scalar(const T* in, T* out, int n, const T* lut, int stride) {
+	const T* r = lut;
+	const T* g = lut + stride;
+	const T* b = lut + 2 * stride;
+	for (int i = 0; i < n; i++) {
+		out[3 * i] = r[in[3 * i]];
+		out[3 * i + 1] = g[in[3 * i + 1]];
+		out[3 * i + 2] = b[in[3 * i + 2]];
+	}
+}
+
+void lut_apply_rgb(const unsigned char* in, unsigned char* out, int n, const unsigned char* lut, int stride) {
+#ifdef LUT_X86
+	if (stride == 256 && detect_simd() == SIMD_AVX512VBMI) {
+		lut_rgb_avx512vbmi(in, out, n, lut);
+		return;
+	}
+#endif
+	lut_rgb_scalar(in, out, n, lut, stride);
+}
+
+void lut_apply_rgb(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut, int stride) {
+	lut_rgb_scalar(in, out, n, lut, stride);
+}
+
+static inline unsigned short swap16(unsigned short x) {
+	return (unsigned short)((x >> 8) | (x << 8));
+}
+
+static void swap_scalar(const unsigned short* in, unsigned short* out, int n) {
+	for (int i = 0; i < n; i++)
+		out[i] = swap16(in[i]);
+}
+
+static void lut_be_scalar(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut) {
+	for (int i = 0; i < n; i++)
+		out[i] = swap16(lut[swap16(in[i])]);
+}
+
+#ifdef LUT_X86
+#define SWAP16_PATTERN 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+
+TARGET("ssse3")
+static void swap_ssse3(const unsigned short* in, unsigned short* out, int n) {
+	const __m128i pattern = _mm_setr_epi8(SWAP16_PATTERN);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm_storeu_si128((__m128i*)(out + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + i)), pattern));
+	swap_scalar(in + i, out + i, n - i);
+}
+
+TARGET("avx2")
+static void swap_avx2(const unsigned short* in, unsigned short* out, int n) {
+	const __m256i pattern = _mm256_setr_epi8(SWAP16_PATTERN, SWAP16_PATTERN);
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+		_mm256_storeu_si256((__m256i*)(out + i),
+			_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in + i)), pattern));
+	swap_scalar(in + i, out + i, n - i);
+}
+
+TARGET("avx512f,avx512bw")
+static void swap_avx512(const unsigned short* in, unsigned short* out, int n) {
+	const __m512i pattern = _mm512_broadcast_i32x4(_mm_setr_epi8(SWAP16_PATTERN));
+	int i = 0;
+	for (; i + 32 <= n; i += 32)
+		_mm512_storeu_si512(out + i, _mm512_shuffle_epi8(_mm512_loadu_si512(in + i), pattern));
+	swap_scalar(in + i, out + i, n - i);
+}
+
+// 16 отсчётов: перестановка байт, расширение до 32 бит, две сборки из таблицы, упаковка обратно
+TARGET("avx2")
+static void lut_be_avx2(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut) {
+	const __m256i pattern = _mm256_setr_epi8(SWAP16_PATTERN, SWAP16_PATTERN);
+	const __m256i low = _mm256_set1_epi32(0xFFFF);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256i x = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in + i)), pattern);
+		const __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(x));
+		const __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(x, 1));
+		const __m256i a = _mm256_and_si256(_mm256_i32gather_epi32((const int*)lut, lo, 2), low);
+		const __m256i b = _mm256_and_si256(_mm256_i32gather_epi32((const int*)lut, hi, 2), low);
+		// packus упаковывает по 128-битным половинам, permute возвращает порядок отсчётов
+		const __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_shuffle_epi8(r, pattern));
+	}
+	lut_be_scalar(in + i, out + i, n - i, lut);
+}
+
+TARGET("avx512f,avx512bw")
+static void lut_be_avx512(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut) {
+	const __m512i pattern = _mm512_broadcast_i32x4(_mm_setr_epi8(SWAP16_PATTERN));
+	int i = 0;
+	for (; i + 32 <= n; i += 32) {
+		const __m512i x = _mm512_shuffle_epi8(_mm512_loadu_si512(in + i), pattern);
+		const __m512i lo = _mm512_cvtepu16_epi32(_mm512_castsi512_si256(x));
+		const __m512i hi = _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(x, 1));
+		// vpmovdw оставляет младшие 16 бит, лишний соседний элемент из сборки отбрасывается
+		const __m256i a = _mm512_cvtepi32_epi16(_mm512_i32gather_epi32(lo, lut, 2));
+		const __m256i b = _mm512_cvtepi32_epi16(_mm512_i32gather_epi32(hi, lut, 2));
+		const __m512i r = _mm512_inserti64x4(_mm512_castsi256_si512(a), b, 1);
+		_mm512_storeu_si512(out + i, _mm512_shuffle_epi8(r, pattern));
+	}
+	lut_be_scalar(in + i, out + i, n - i, lut);
+}
+#endif
+
+void lut_apply_be(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut) {
+#ifdef LUT_X86
+	switch (detect_simd()) {
+	case SIMD_AVX512VBMI:
+		lut_be_avx512(in, out, n, lut);
+		return;
+	case SIMD_AVX2:
+		lut_be_avx2(in, out, n, lut);
+		return;
+	default:
+		break;
+	}
+#endif
+	lut_be_scalar(in, out, n, lut);
+}
+
+void lut_apply_rgb_be(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut, int stride) {
+	const unsigned short* r = lut;
+	const unsigned short* g = lut + stride;
+	const unsigned short* b = lut + 2 * stride;
+	for (int i = 0; i < n; i++) {
+		out[3 * i] = swap16(r[swap16(in[3 * i])]);
+		out[3 * i + 1] = swap16(g[swap16(in[3 * i + 1])]);
+		out[3 * i + 2] = swap16(b[swap16(in[3 * i + 2])]);
+	}
+}
+
+void swap_bytes16(const unsigned short* in, unsigned short* out, int n) {
+#ifdef LUT_X86
+	switch (detect_simd()) {
+	case SIMD_AVX512VBMI:
+		swap_avx512(in, out, n);
+		return;
+	case SIMD_AVX2:
+		swap_avx2(in, out, n);
+		return;
+	case SIMD_SSSE3:
+		swap_ssse3(in, out, n);
+		return;
+	default:
+		break;
+	}
+#endif
+	swap_scalar(in, out, n);
+}
+
+static void lerp_scalar(const unsigned char* in, unsigned char* out, int n, const float* left, const float* right,
+	const int* base, const float* wx, int colors) {
+	for (int i = 0; i < n; i++) {
+		const int k = base[i] + (in[i] > colors ? colors : in[i]);
+		out[i] = (unsigned char)(left[k] + (right[k] - left[k]) * wx[i] + 0.5f);
+	}
+}
+
+#ifdef LUT_X86
+// 8 отсчётов: две сборки float из таблиц, интерполяция, упаковка в байты
+TARGET("avx2")
+static void lerp_avx2(const unsigned char* in, unsigned char* out, int n, const float* left, const float* right,
+	const int* base, const float* wx, int colors) {
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256i limit = _mm256_set1_epi32(colors);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i k = _mm256_add_epi32(
+			_mm256_min_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i))), limit),
+			_mm256_loadu_si256((const __m256i*)(base + i)));
+		const __m256 a = _mm256_i32gather_ps(left, k, 4);
+		const __m256 b = _mm256_i32gather_ps(right, k, 4);
+		const __m256 r = _mm256_add_ps(_mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), _mm256_loadu_ps(wx + i))),
+			half);
+		const __m256i x = _mm256_cvttps_epi32(r);
+		const __m128i p = _mm_packus_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+		_mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(p, p));
+	}
+	lerp_scalar(in + i, out + i, n - i, left, right, base + i, wx + i, colors);
+}
+
+TARGET("avx512f")
+static void lerp_avx512(const unsigned char* in, unsigned char* out, int n, const float* left, const float* right,
+	const int* base, const float* wx, int colors) {
+	const __m512 half = _mm512_set1_ps(0.5f);
+	const __m512i limit = _mm512_set1_epi32(colors);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m512i k = _mm512_add_epi32(
+			_mm512_min_epi32(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(in + i))), limit),
+			_mm512_loadu_si512(base + i));
+		const __m512 a = _mm512_i32gather_ps(k, left, 4);
+		const __m512 b = _mm512_i32gather_ps(k, right, 4);
+		const __m512 r = _mm512_add_ps(_mm512_add_ps(a, _mm512_mul_ps(_mm512_sub_ps(b, a), _mm512_loadu_ps(wx + i))),
+			half);
+		_mm_storeu_si128((__m128i*)(out + i), _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(r)));
+	}
+	lerp_scalar(in + i, out + i, n - i, left, right, base + i, wx + i, colors);
+}
+#endif
+
+void lut_lerp(const unsigned char* in, unsigned char* out, int n, const float* left, const float* right,
+	const int* base, const float* wx, int colors) {
+#ifdef LUT_X86
+	switch (detect_simd()) {
+	case SIMD_AVX512VBMI:
+		lerp_avx512(in, out, n, left, right, base, wx, colors);
+		return;
+	case SIMD_AVX2:
+		lerp_avx2(in, out, n, left, right, base, wx, colors);
+		return;
+	default:
+		break;
+	}
+#endif
+	lerp_scalar(in, out, n, left, right, base, wx, colors);
+}
+
+void lut_bilinear(const unsigned short* in, unsigned short* out, int n, const float* const* luts, const int* base,
+	const float* wx, float wy, int shift, bool big_endian, int colors) {
+	for (int i = 0; i < n; i++) {
+		int v = big_endian ? swap16(in[i]) : in[i];
+		if (v > colors)
+			v = colors;
+		const int k = base[i] + (v >> shift);
+		const float top = luts[0][k] + (luts[1][k] - luts[0][k]) * wx[i];
+		const float bottom = luts[2][k] + (luts[3][k] - luts[2][k]) * wx[i];
+		const unsigned short r = (unsigned short)(top + (bottom - top) * wy + 0.5f);
+		out[i] = big_endian ? swap16(r) : r;
+	}
+}
+
+static void luma_scalar(const unsigned char* rgb, unsigned char* y, int n) {
+	for (int i = 0; i < n; i++)
+		y[i] = (unsigned char)((LUMA_R * rgb[3 * i] + LUMA_G * rgb[3 * i + 1] + LUMA_B * rgb[3 * i + 2] + 128) >> 8);
+}
+
+#ifdef LUT_X86
+/**
+ *	Маски pshufb, собирающие из 48 байт (16 пикселей) отсчёты одного канала:
+ *	luma_masks[канал][блок из 16 байт], -1 обнуляет байт
+ **/
+static const signed char luma_masks[3][3][16] = {
+	{ { 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13 } },
+	{ { 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14 } },
+	{ { 2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15 } }
+};
+
+TARGET("ssse3")
+static inline __m128i luma_channel(__m128i a, __m128i b, __m128i c, int ch) {
+	return _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(a, _mm_loadu_si128((const __m128i*)luma_masks[ch][0])),
+		_mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i*)luma_masks[ch][1]))),
+		_mm_shuffle_epi8(c, _mm_loadu_si128((const __m128i*)luma_masks[ch][2])));
+}
+
+// 16 пикселей: разбор каналов, 16-битные произведения на веса, сумма, сдвиг, упаковка в байты
+TARGET("ssse3")
+static void luma_ssse3(const unsigned char* rgb, unsigned char* y, int n) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wr = _mm_set1_epi16(LUMA_R), wg = _mm_set1_epi16(LUMA_G), wb = _mm_set1_epi16(LUMA_B);
+	const __m128i round = _mm_set1_epi16(128);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m128i a = _mm_loadu_si128((const __m128i*)(rgb + 3 * i));
+		const __m128i b = _mm_loadu_si128((const __m128i*)(rgb + 3 * i + 16));
+		const __m128i c = _mm_loadu_si128((const __m128i*)(rgb + 3 * i + 32));
+		const __m128i r = luma_channel(a, b, c, 0), g = luma_channel(a, b, c, 1), bl = luma_channel(a, b, c, 2);
+		// максимум 255 * 256 + 128 помещается в беззнаковые 16 бит
+		const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpacklo_epi8(r, zero), wr), _mm_mullo_epi16(_mm_unpacklo_epi8(g, zero), wg)),
+			_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(bl, zero), wb), round)), 8);
+		const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpackhi_epi8(r, zero), wr), _mm_mullo_epi16(_mm_unpackhi_epi8(g, zero), wg)),
+			_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(bl, zero), wb), round)), 8);
+		_mm_storeu_si128((__m128i*)(y + i), _mm_packus_epi16(lo, hi));
+	}
+	luma_scalar(rgb + 3 * i, y + i, n - i);
+}
+
+TARGET("avx2")
+static inline __m256i luma_channel(__m256i a, __m256i b, __m256i c, int ch) {
+	return _mm256_or_si256(_mm256_or_si256(
+		_mm256_shuffle_epi8(a, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)luma_masks[ch][0]))),
+		_mm256_shuffle_epi8(b, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)luma_masks[ch][1])))),
+		_mm256_shuffle_epi8(c, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)luma_masks[ch][2]))));
+}
+
+// то же для 32 пикселей: в каждой 128-битной половине регистров свои 16 пикселей
+TARGET("avx2")
+static void luma_avx2(const unsigned char* rgb, unsigned char* y, int n) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i wr = _mm256_set1_epi16(LUMA_R), wg = _mm256_set1_epi16(LUMA_G), wb = _mm256_set1_epi16(LUMA_B);
+	const __m256i round = _mm256_set1_epi16(128);
+	int i = 0;
+	for (; i + 32 <= n; i += 32) {
+		const unsigned char* p = rgb + 3 * i;
+		const __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p)),
+			_mm_loadu_si128((const __m128i*)(p + 48)), 1);
+		const __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p + 16))),
+			_mm_loadu_si128((const __m128i*)(p + 64)), 1);
+		const __m256i c = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p + 32))),
+			_mm_loadu_si128((const __m128i*)(p + 80)), 1);
+		const __m256i r = luma_channel(a, b, c, 0), g = luma_channel(a, b, c, 1), bl = luma_channel(a, b, c, 2);
+		const __m256i lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(
+			_mm256_mullo_epi16(_mm256_unpacklo_epi8(r, zero), wr), _mm256_mullo_epi16(_mm256_unpacklo_epi8(g, zero), wg)),
+			_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(bl, zero), wb), round)), 8);
+		const __m256i hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(
+			_mm256_mullo_epi16(_mm256_unpackhi_epi8(r, zero), wr), _mm256_mullo_epi16(_mm256_unpackhi_epi8(g, zero), wg)),
+			_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(bl, zero), wb), round)), 8);
+		// unpack и packus работают внутри половин, поэтому порядок пикселей сохраняется
+		_mm256_storeu_si256((__m256i*)(y + i), _mm256_packus_epi16(lo, hi));
+	}
+	luma_scalar(rgb + 3 * i, y + i, n - i);
+}
+#endif
+
+void rgb_luma(const unsigned char* rgb, unsigned char* y, int n) {
+#ifdef LUT_X86
+	switch (detect_simd()) {
+	case SIMD_AVX512VBMI:
+	case SIMD_AVX2:
+		luma_avx2(rgb, y, n);
+		return;
+	case SIMD_SSSE3:
+		luma_ssse3(rgb, y, n);
+		return;
+	default:
+		break;
+	}
+#endif
+	luma_scalar(rgb, y, n);
+}
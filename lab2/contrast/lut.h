@@ -0,0 +1,59 @@
+#pragma once
+
+enum simd_level { SIMD_SCALAR, SIMD_SSSE3, SIMD_AVX2, SIMD_AVX512VBMI };
+
+// лучший набор инструкций, поддерживаемый процессором и ОС (определяется один раз)
+simd_level detect_simd();
+const char* simd_name(simd_level level);
+
+/**
+ *	out[i] = lut[in[i]] для n отсчётов, out может совпадать с in.
+ *	Таблица из 256 элементов делится на части по 16 (pshufb, SSSE3/AVX2)
+ *	или по 64 (vpermi2b, AVX-512 VBMI) элементов
+ **/
+void lut_apply(const unsigned char* in, unsigned char* out, int n, const unsigned char* lut);
+
+// то же для 16-битных отсчётов, таблица из 65536 элементов (на любое значение отсчёта)
+void lut_apply(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut);
+
+/**
+ *	Три таблицы по stride элементов для чередующихся отсчётов R, G, B
+ *	@param n Количество пикселей (троек отсчётов)
+ **/
+void lut_apply_rgb(const unsigned char* in, unsigned char* out, int n, const unsigned char* lut, int stride);
+void lut_apply_rgb(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut, int stride);
+
+/**
+ *	Отсчёты в порядке Netpbm (старший байт вперёд): байты переставляются при чтении
+ *	и при записи, отдельных проходов не нужно. AVX2 и AVX-512 читают таблицу сборкой
+ *	по 32 бита, поэтому за последним элементом таблицы должен быть ещё один
+ **/
+void lut_apply_be(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut);
+void lut_apply_rgb_be(const unsigned short* in, unsigned short* out, int n, const unsigned short* lut, int stride);
+
+/**
+ *	Интерполяция между таблицами двух соседних тайлов (локальный контраст):
+ *	out[i] = left[k] + (right[k] - left[k]) * wx[i], k = base[i] + min(in[i], colors).
+ *	Таблицы float в единицах выходных отсчётов
+ **/
+void lut_lerp(const unsigned char* in, unsigned char* out, int n, const float* left, const float* right,
+	const int* base, const float* wx, int colors);
+
+/**
+ *	Билинейная интерполяция между таблицами четырёх тайлов: верхние luts[0] (левая),
+ *	luts[1] (правая), нижние luts[2], luts[3], индекс - base[i] + (min(отсчёт, colors) >> shift)
+ *	@param wy Вес нижних таблиц, общий для строки
+ **/
+void lut_bilinear(const unsigned short* in, unsigned short* out, int n, const float* const* luts, const int* base,
+	const float* wx, float wy, int shift, bool big_endian, int colors);
+
+// яркость в фиксированной точке (BT.601): Y = (LUMA_R * R + LUMA_G * G + LUMA_B * B + 128) >> 8
+#define LUMA_R 77
+#define LUMA_G 150
+#define LUMA_B 29
+
+// яркость n пикселей RGB; SIMD-версии разбирают тройки отсчётов перестановками pshufb
+void rgb_luma(const unsigned char* rgb, unsigned char* y, int n);
+
+// перестановка байт 16-битных отсчётов, out может совпадать с in
+void swap_bytes16(const unsigned short* in, unsigned short* out, int n);
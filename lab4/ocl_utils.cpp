@@ -0,0 +1,128 @@
+#include "ocl_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+std::vector<cl_device_id> all_devices;
+
+int getDevices() {
+	std::vector<cl_device_id> discrete_gpu, integrated_gpu, cpu;
+	int i, j;
+
+	cl_uint deviceCount;
+	cl_device_id* devices;
+	cl_platform_id platform = 0;
+	cl_device_type value;
+	size_t valueSize;
+	cl_uint maxComputeUnits;
+	clGetPlatformIDs(1, &platform, NULL);
+	// get all devices
+	clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &deviceCount);
+	devices = (cl_device_id*)malloc(sizeof(cl_device_id) * deviceCount);
+	clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, deviceCount, devices, NULL);
+
+	// for each device print critical attributes
+	for (j = 0; j < deviceCount; j++) {
+		clGetDeviceInfo(devices[j], CL_DEVICE_TYPE, sizeof(cl_device_type), &value, NULL);
+		if ((cl_device_type)value == CL_DEVICE_TYPE_CPU)
+		{
+			cpu.push_back(devices[j]);
+		}
+		else if ((cl_device_type)value == CL_DEVICE_HOST_UNIFIED_MEMORY)
+		{
+			integrated_gpu.push_back(devices[j]);
+		}
+		else {
+			discrete_gpu.push_back(devices[j]);
+		}
+	}
+	free(devices);
+
+	all_devices.insert(all_devices.end(), discrete_gpu.begin(), discrete_gpu.end());
+	all_devices.insert(all_devices.end(), integrated_gpu.begin(), integrated_gpu.end());
+	all_devices.insert(all_devices.end(), cpu.begin(), cpu.end());
+
+	return deviceCount;
+}
+
+void error(const char* msg)
+{
+	printf("%s\n", msg);
+	exit(-1);
+}
+
+cl_program getProgram(const char* path, const cl_context context)
+{
+	cl_int err;
+	FILE* sourceFile = fopen(path, "rb");
+
+	fseek(sourceFile, 0, SEEK_END);
+	size_t sourceFileSize = ftell(sourceFile);
+
+	fseek(sourceFile, 0, 0);
+	const char* sourceCode = (char*)malloc(sourceFileSize * sizeof(char));
+	fread((char*)sourceCode, sizeof(char), sourceFileSize, sourceFile);
+
+	fclose(sourceFile);
+
+	cl_program program = clCreateProgramWithSource(context,
+		1,
+		&sourceCode,
+		&sourceFileSize,
+		&err);
+	if (err != 0)
+		error("Error: init OpenCL");
+
+	return program;
+}
+
+void buildProgram(const cl_program program, const cl_device_id deviceID)
+{
+	cl_int err = clBuildProgram(program, 1, &deviceID, "", NULL, NULL);
+	if (err != 0) {
+		size_t logSize;
+
+		clGetProgramBuildInfo(program, deviceID, CL_PROGRAM_BUILD_LOG, 0, NULL, &logSize);
+
+		char* log = (char*)malloc(logSize * sizeof(char));
+
+		clGetProgramBuildInfo(program, deviceID, CL_PROGRAM_BUILD_LOG, logSize, log, NULL);
+		printf("Build error: %s\n", log);
+	}
+	if (err != 0)
+		error("Error: init OpenCL");
+}
+
+cl_kernel createKernel(const cl_program program, const char* kernelName)
+{
+	cl_int err;
+	cl_kernel kernel = clCreateKernel(program, kernelName, &err);
+
+	if (err != 0)
+		error("Error: init OpenCL");
+	return kernel;
+}
+
+cl_mem createBuffer(const cl_context context, const size_t size, const cl_mem_flags flags)
+{
+	cl_int err;
+	cl_mem buf = clCreateBuffer(context, flags, size, NULL, &err);
+
+	if (err != 0)
+		error("Error: init OpenCL");
+
+	return buf;
+}
+
+void enqueueWriteBuffer(const cl_command_queue queue, const cl_mem buf, const size_t size, const float* vector)
+{
+	clEnqueueWriteBuffer(queue, buf, CL_FALSE, 0, size, vector, 0, NULL, NULL);
+}
+
+double getTime(cl_event event)
+{
+	cl_ulong start_time, end_time;
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start_time, NULL);
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end_time, NULL);
+	double total_time = (end_time - start_time) * 1e-6;
+	return total_time;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#define CL_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_CL_1_2_DEFAULT_BUILD
+#define CL_HPP_ENABLE_EXCEPTIONS
+
+#include <CL/cl.h>
+#include <vector>
+
+// девайсы в порядке: дискретные GPU, интегрированные GPU, CPU
+extern std::vector<cl_device_id> all_devices;
+
+int getDevices();
+void error(const char* msg);
+cl_program getProgram(const char* path, const cl_context context);
+void buildProgram(const cl_program program, const cl_device_id deviceID);
+cl_kernel createKernel(const cl_program program, const char* kernelName);
+cl_mem createBuffer(const cl_context context, const size_t size, const cl_mem_flags flags = CL_MEM_READ_ONLY);
+void enqueueWriteBuffer(const cl_command_queue queue, const cl_mem buf, const size_t size, const float* vector);
+double getTime(cl_event event);